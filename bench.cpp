@@ -0,0 +1,1733 @@
+/*
+ * Benchmarks for libtypeinfer.
+ *
+ * ./bench                 all of the following
+ * ./bench --csv ...       the same, as name,items,unit,seconds,rate,allocs records for tracking regressions
+ * ./bench tree [depth]    one generated full expression tree of the given depth (default 16)
+ *   tokenize: pull every token out of a Lexer, interning the variable names
+ *   dispatch: traverse the AST with the NodeKind switch and with the string-compare +
+ *             dynamic_cast dispatch that it replaced
+ *   typecheck: typecheck() on the pointer AST and on the flat AST, and the single-pass parseAndTypecheck()
+ *              (which includes tokenizing)
+ *   end-to-end: tokenize + parse + typecheck of the generated expression, as the REPL does it
+ * ./bench families [log2 size]
+ *                         every phase (tokenize, parse, tree and flat typecheck, fused) on generated families of
+ *                         about 2^size nodes (default 18): a mixed tree, a deep subtraction chain, a wide if tree,
+ *                         a let chain, many distinct variables, and a chain whose type error is at its end;
+ *                         each phase also reports its allocations per node
+ * ./bench unionfind       UnionFind on chains of doubling length; the time per operation should stay flat;
+ *                         UndoUnionFind on the same pairs, then rolled back; ConcurrentUnionFind with 1, 2, 4, ...
+ *                         threads on random pairs and on pairs that all join one class, against UnionFind
+ * ./bench chain           let chains, nested ifs and lets that all bind the same name, of doubling length, through
+ *                         parseAndTypecheck()
+ * ./bench depth           (- (- ... (- x 1) ... 1) 1) of growing depth through each engine; the time per node should
+ *                         stay flat
+ * ./bench batch [lines]   processLines() on generated lines (default 2^16) with 1, 2, 4, ... threads up to one per
+ *                         core (at least 4), and with a result cache; the output must not depend on either
+ * ./bench incremental [depth]
+ *                         IncrementalChecker against check() on a tree of the given depth (default 16) with one
+ *                         literal edited near its start, middle and end, each edit made again and again; then
+ *                         random edits near one place in a large random expression, which must agree with check()
+ * ./bench parallel [log2 size]
+ *                         typecheckParallel() with 1, 2, 4, ... threads up to one per core (at least 4) against
+ *                         typecheck() on the flat ASTs of the mixed, if-tree and vars families (default 2^20 nodes)
+ * ./bench image [log2 size]
+ *                         an AST image of the mixed family (default 2^20 nodes): writing it, loading it, checking
+ *                         it and reading its stored types, against check() of the source
+ * ./bench session [lines] a Session fed declarations let vb = (- va 1), let vc = (- vb 1), ... of doubling number
+ *                         up to the given one (default 2^16); the time per line should stay flat. Then one more
+ *                         line after all of them, against check() of the whole program as one nested let
+ * ./bench operators [n]   a chain of n comparisons (default 2^14) with + && || ! <= > >= == != written natively,
+ *                         against the same chain through their encodings in the core operators; the types must
+ *                         be the same. typecheckParallel() must agree with typecheck() on chains under !
+ * ./bench fuzz [samples]  random expressions (default 2^14), well- and ill-typed, some with a random edit, through
+ *                         every engine against typecheck() on the parsed tree, then through processLines(); the
+ *                         types, or the kind, message and position of the error, must agree
+ * ./bench scaling [log2 size]
+ *                         every engine on every family at doubling sizes from 2^11 nodes up to 2^size (default 17);
+ *                         the peak live bytes, and the time divided by that of parse() (the lexer's by a byte
+ *                         scan), fitted to n^k over the sizes, must have k <= 1.07, and the raw time k <= 1.3
+ */
+
+#include "typeinfer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace typeinfer;
+
+// ============================================= input generation ==============================================
+
+// a variable name from a number: va, vb, ..., vz, vab, ... (never a keyword)
+std::string nameOf(int x) {
+	std::string s = "v";
+	do {
+		s.push_back('a' + x % 26);
+		x /= 26;
+	} while (x > 0);
+	return s;
+}
+
+// a well-typed integer expression: a full tree of the given depth mixing all node types
+void genInt(int depth, int &id, std::string &out) {
+	if (depth == 0) {
+		if (id++ % 2 == 0) {
+			out += std::to_string(id);
+		} else {
+			out += nameOf(id);
+		}
+		return;
+	}
+	switch (depth % 4) {
+	case 0:
+		out += "(- ";
+		genInt(depth - 1, id, out);
+		out += " ";
+		genInt(depth - 1, id, out);
+		out += ")";
+		break;
+	case 1:
+		out += "(* ";
+		genInt(depth - 1, id, out);
+		out += " ";
+		genInt(depth - 1, id, out);
+		out += ")";
+		break;
+	case 2:
+		out += "(if (< ";
+		genInt(depth - 1, id, out);
+		out += " 0) then ";
+		genInt(depth - 1, id, out);
+		out += " else 1)";
+		break;
+	case 3:
+		out += "(let " + nameOf(id++) + " = ";
+		genInt(depth - 1, id, out);
+		out += " in ";
+		genInt(depth - 1, id, out);
+		out += ")";
+		break;
+	}
+}
+
+// (let va = x in (let vb = va in ... (let vz = vy in vz))): every binding joins the previous one
+std::string genLetChain(int n) {
+	std::string s;
+	std::string prev = "x";
+	for (int i = 0; i < n; i++) {
+		std::string v = nameOf(i);
+		s += "(let " + v + " = " + prev + " in ";
+		prev = v;
+	}
+	s += prev;
+	s += std::string(n, ')');
+	return s;
+}
+
+// (let x = x in (let x = x in ... x)): n nested lets, each one binding x to the x of the one outside it
+std::string genShadowChain(int n) {
+	std::string s;
+	for (int i = 0; i < n; i++) {
+		s += "(let x = x in ";
+	}
+	s += "x";
+	s += std::string(n, ')');
+	return s;
+}
+
+// (if c then (if c then ... x else vb) else va): every branch joins the innermost variable
+std::string genIfChain(int n) {
+	std::string s;
+	for (int i = 0; i < n; i++) {
+		s += "(if c then ";
+	}
+	s += "x";
+	for (int i = n - 1; i >= 0; i--) {
+		s += " else " + nameOf(i) + ")";
+	}
+	return s;
+}
+
+// (- (- ... (- x 1) ... 1) 1): n nested subtractions, each one the first operand of the next
+std::string genSubChain(int n) {
+	std::string s;
+	for (int i = 0; i < n; i++) {
+		s += "(- ";
+	}
+	s += "x";
+	for (int i = 0; i < n; i++) {
+		s += " 1)";
+	}
+	return s;
+}
+
+// (if va then T else T), with T of depth - 1 and variables at the leaves: a wide balanced tree of ifs
+void genIfTree(int depth, int &id, std::string &out) {
+	if (depth == 0) {
+		out += nameOf(id++);
+		return;
+	}
+	out += "(if " + nameOf(id++) + " then ";
+	genIfTree(depth - 1, id, out);
+	out += " else ";
+	genIfTree(depth - 1, id, out);
+	out += ")";
+}
+
+// a balanced tree of subtractions over 2^depth distinct variables
+void genVarTree(int depth, int &id, std::string &out) {
+	if (depth == 0) {
+		out += nameOf(id++);
+		return;
+	}
+	out += "(- ";
+	genVarTree(depth - 1, id, out);
+	out += " ";
+	genVarTree(depth - 1, id, out);
+	out += ")";
+}
+
+// genSubChain(n) with its last operand a boolean, so the type error is only found at the very end
+std::string genSubError(int n) {
+	std::string s = genSubChain(n);
+	s.replace(s.size() - 2, 1, "true");
+	return s;
+}
+
+// (op a b), or (! a), in the operators of the core grammar, by the encodings in the header of typeinfer.h
+std::string encode(const std::string &op, const std::string &a, const std::string &b) {
+	if (op == "+") {
+		return "(- " + a + " (- 0 " + b + "))";
+	} else if (op == "&&") {
+		return "(if " + a + " then " + b + " else false)";
+	} else if (op == "||") {
+		return "(if " + a + " then true else " + b + ")";
+	} else if (op == "!") {
+		return "(if " + a + " then false else true)";
+	} else if (op == "<=") {
+		return encode("!", "(< " + b + " " + a + ")", "");
+	} else if (op == ">") {
+		return "(< " + b + " " + a + ")";
+	} else if (op == ">=") {
+		return encode("<=", b, a);
+	} else if (op == "==") {
+		return encode("&&", encode("!", "(< " + a + " " + b + ")", ""), encode("!", "(< " + b + " " + a + ")", ""));
+	} else if (op == "!=") {
+		return encode("!", encode("==", a, b), "");
+	}
+	return "(" + op + " " + a + " " + b + ")";
+}
+
+// (op a b), or (! a) if b is empty, natively or encoded
+std::string apply(bool native, const std::string &op, const std::string &a, const std::string &b = "") {
+	if (!native) {
+		return encode(op, a, b);
+	}
+	return "(" + op + " " + a + (b.empty() ? "" : " " + b) + ")";
+}
+
+// (&& C0 (&& C1 ... (|| C3 ... true))): a chain of n comparisons of sums of variables, every third one negated
+std::string genComparisons(int n, bool native) {
+	static const char *comparisons[] = {"<=", ">", ">=", "==", "!="};
+	std::string s;
+	std::vector<std::string> closing;
+	for (int i = 0; i < n; i++) {
+		std::string c = apply(native, comparisons[i % 5], apply(native, "+", nameOf(i), "1"), nameOf(i + 1));
+		if (i % 3 == 2) {
+			c = apply(native, "!", c);
+		}
+		bool disjunction = i % 4 == 3;
+		if (native) {
+			s += std::string(disjunction ? "(|| " : "(&& ") + c + " ";
+			closing.push_back(")");
+		} else {
+			s += "(if " + c + (disjunction ? " then true else " : " then ");
+			closing.push_back(disjunction ? ")" : " else false)");
+		}
+	}
+	s += "true";
+	for (auto i = closing.rbegin(); i != closing.rend(); ++i) {
+		s += *i;
+	}
+	return s;
+}
+
+// the pseudo-random numbers of the generators below, as benchConcurrentUnionFind() draws them
+struct Random {
+	// a number in [0, n)
+	unsigned below(unsigned n) {
+		x = x * 1103515245u + 12345u;
+		return (x >> 8) % n;
+	}
+
+	unsigned x = 1;
+};
+
+/*
+ * A random expression of about budget nodes of the given type (INT or BOOL), built from every kind of node, with the
+ * operators drawn from operator_rules. It is well-typed unless a leaf gets the other type, which each one does with
+ * the probability 1 / wrong (never if wrong is 0). Variables are typed by name: a to d are integers, p to s booleans,
+ * and h only ever bound to the unused variable of a let, so its type stays generic.
+ */
+void genRandom(Random &r, int budget, int type, unsigned wrong, std::string &out) {
+	static const char *names[2][4] = {{"a", "b", "c", "d"}, {"p", "q", "r", "s"}};
+	if (budget <= 1) {
+		if (wrong != 0 && r.below(wrong) == 0) {
+			type = type == INT ? BOOL : INT;
+		}
+		unsigned leaf = r.below(8);
+		if (leaf == 0) {
+			out += "(let u = h in ";
+		}
+		if (leaf <= 2) {
+			out += type == INT ? std::to_string(static_cast<int>(r.below(200)) - 100) : r.below(2) ? "true" : "false";
+		} else {
+			out += names[type == BOOL][r.below(4)];
+		}
+		if (leaf == 0) {
+			out += ")";
+		}
+		return;
+	}
+	budget--;
+	unsigned shape = r.below(10);
+	if (shape == 0) { // ( if <expr1> then <expr2> else <expr3> )
+		int b1 = r.below(budget / 3 + 1), b2 = r.below(budget - b1 + 1);
+		out += "(if ";
+		genRandom(r, b1, BOOL, wrong, out);
+		out += " then ";
+		genRandom(r, b2, type, wrong, out);
+		out += " else ";
+		genRandom(r, budget - b1 - b2, type, wrong, out);
+		out += ")";
+	} else if (shape == 1) { // ( let <variable> = <expr1> in <expr2> ), with a variable of the type of <expr1>
+		int bound = r.below(2) ? INT : BOOL, b1 = r.below(budget + 1);
+		out += std::string("(let ") + names[bound == BOOL][r.below(4)] + " = ";
+		genRandom(r, b1, bound, wrong, out);
+		out += " in ";
+		genRandom(r, budget - b1, type, wrong, out);
+		out += ")";
+	} else { // an operator with the result type
+		std::vector<const OperatorRule*> rules;
+		for (const OperatorRule &rule : operator_rules) {
+			if (rule.result == type) {
+				rules.push_back(&rule);
+			}
+		}
+		const OperatorRule &rule = *rules[r.below(rules.size())];
+		int b1 = rule.arity == 1 ? budget : r.below(budget + 1);
+		out += std::string("(") + rule.symbol + " ";
+		genRandom(r, b1, rule.operand, wrong, out);
+		if (rule.arity == 2) {
+			out += " ";
+			genRandom(r, budget - b1, rule.operand, wrong, out);
+		}
+		out += ")";
+	}
+}
+
+// one random edit of text, which mostly makes it ill-formed: a character deleted, a token inserted, a piece
+// repeated, or the rest cut off
+void mutate(Random &r, std::string &text) {
+	static const char *tokens[] = {"(", ")", "-", "!", "=", "==", "&", "let", "in", "if", "else", "x", "7", " ",
+		"true", "99999999999", "-0"};
+	std::size_t at = r.below(text.size() + 1);
+	switch (r.below(4)) {
+	case 0:
+		text.erase(at, 1);
+		break;
+	case 1:
+		text.insert(at, tokens[r.below(sizeof tokens / sizeof tokens[0])]);
+		break;
+	case 2:
+		text.insert(at, text.substr(at, r.below(16)));
+		break;
+	default:
+		text.resize(at);
+		break;
+	}
+}
+
+// ================================================ dispatch ===================================================
+
+// the type name that Node::getType() used to return
+std::string legacyType(Node *n) {
+	static const char *names[] = {"Var", "Int", "Bool", "Sub", "Mul", "Div", "Lt", "Add", "And", "Or", "Not", "Le",
+		"Gt", "Ge", "Eq", "Ne", "If", "Let"};
+	return names[static_cast<int>(n->kind)];
+}
+
+// dfs() as it was before NodeKind
+template<typename F> void legacyDfs(Node *root, F f) {
+	f(root);
+	if (legacyType(root) == "Sub") {
+		auto r = dynamic_cast<Operation*>(root);
+		legacyDfs(r->n1, f);
+		legacyDfs(r->n2, f);
+	} else if (legacyType(root) == "Mul") {
+		auto r = dynamic_cast<Operation*>(root);
+		legacyDfs(r->n1, f);
+		legacyDfs(r->n2, f);
+	} else if (legacyType(root) == "Div") {
+		auto r = dynamic_cast<Operation*>(root);
+		legacyDfs(r->n1, f);
+		legacyDfs(r->n2, f);
+	} else if (legacyType(root) == "Lt") {
+		auto r = dynamic_cast<Operation*>(root);
+		legacyDfs(r->n1, f);
+		legacyDfs(r->n2, f);
+	} else if (legacyType(root) == "If") {
+		auto r = dynamic_cast<If*>(root);
+		legacyDfs(r->n1, f);
+		legacyDfs(r->n2, f);
+		legacyDfs(r->n3, f);
+	} else if (legacyType(root) == "Let") {
+		auto r = dynamic_cast<Let*>(root);
+		legacyDfs(r->n1, f);
+		legacyDfs(r->n2, f);
+		legacyDfs(r->n3, f);
+	}
+}
+
+// ================================================== driver ===================================================
+
+// Every allocation of the program is counted, so the phases can report allocations per node; and the bytes live, and
+// their high-water mark, so the scaling mode can report the peak memory per node. Each block starts with its size.
+std::atomic<long long> allocations(0), live_bytes(0), peak_bytes(0);
+const std::size_t HEADER = alignof(std::max_align_t);
+
+void *operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	long long live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	for (long long peak = peak_bytes; live > peak && !peak_bytes.compare_exchange_weak(peak, live); ) {
+	}
+	if (char *block = static_cast<char*>(std::malloc(HEADER + size))) {
+		*reinterpret_cast<std::size_t*>(block) = size;
+		return block + HEADER;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	if (p != nullptr) {
+		char *block = static_cast<char*>(p) - HEADER;
+		live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+		std::free(block);
+	}
+}
+
+// --csv: print "name,items,unit,seconds,rate,allocs" records instead of a table
+bool csv = false;
+
+double now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the throughput of one measurement, and its allocations per item if known
+void report(const char *name, long long items, double seconds, const char *unit = "nodes", long long allocs = -1) {
+	if (csv) {
+		std::printf("%s,%lld,%s,%.6f,%.0f,", name, items, unit, seconds, items / seconds);
+		if (allocs >= 0) {
+			std::printf("%.4f", static_cast<double>(allocs) / items);
+		}
+		std::printf("\n");
+		return;
+	}
+	std::printf("%-32s %12lld %-6s %10.4f s %10.2f M%s/s", name, items, unit, seconds, items / seconds / 1e6, unit);
+	if (allocs >= 0) { // per node, not per nodes
+		std::printf(" %10.4f allocs/%.*s", static_cast<double>(allocs) / items, static_cast<int>(std::strlen(unit)) - 1,
+			unit);
+	}
+	std::printf("\n");
+}
+
+// a speedup or any other ratio between two measurements
+void ratio(const std::string &name, double x, const std::string &detail = "") {
+	if (csv) {
+		std::printf("%s,,ratio,,%.4f,\n", name.c_str(), x);
+	} else if (detail.empty()) {
+		std::printf("%-32s %12.2fx\n", name.c_str(), x);
+	} else {
+		std::printf("%-32s %12.2fx (%s)\n", name.c_str(), x, detail.c_str());
+	}
+}
+
+// a count out of a total, such as the inputs that fail a check
+void fraction(const std::string &name, long long part, long long whole, const char *unit) {
+	if (csv) {
+		std::printf("%s,%lld,%s,,%.4f,\n", name.c_str(), part, unit, static_cast<double>(part) / whole);
+	} else {
+		std::printf("%-32s %12lld of %lld %s (%.4f)\n", name.c_str(), part, whole, unit,
+			static_cast<double>(part) / whole);
+	}
+}
+
+// the exponent k of a measurement that grows as n^k
+void exponent(const std::string &name, double k, const std::string &detail) {
+	if (csv) {
+		std::printf("%s,,exponent,,%.4f,\n", name.c_str(), k);
+	} else {
+		std::printf("%-32s %10s%.2f (%s)\n", name.c_str(), "n^", k, detail.c_str());
+	}
+}
+
+bool benchTree(int depth) {
+	int id = 0;
+	std::string source;
+	genInt(depth, id, source);
+
+	double t0 = now();
+	long long token_count = 0;
+	SymbolTable symbols;
+	Status status;
+	Lexer tokens(source, symbols, status);
+	while (tokens.next().kind != TokenKind::End) {
+		token_count++;
+	}
+	double t1 = now();
+	report("tokenize", source.size(), t1 - t0, "bytes");
+	report("tokenize", token_count, t1 - t0, "tokens");
+
+	Arena arena;
+	symbols.clear(); // A name is declared again by each parse, so each parse starts afresh.
+	Lexer lex(source, symbols, status);
+	auto root = parse(lex, arena, status);
+	long long nodes = 0;
+	dfs(root, [&nodes](Node *) -> bool {
+		nodes++;
+		return true;
+	});
+	const int rounds = 20;
+
+	long long vars = 0;
+	t0 = now();
+	for (int i = 0; i < rounds; i++) {
+		dfs(root, [&vars](Node *cur) -> bool {
+			vars += cur->kind == NodeKind::Var;
+			return true;
+		});
+	}
+	t1 = now();
+	for (int i = 0; i < rounds; i++) {
+		legacyDfs(root, [&vars](Node *cur) -> void {
+			vars += legacyType(cur) == "Var";
+		});
+	}
+	double t2 = now();
+	report("dispatch/kind-switch", nodes * rounds, t1 - t0);
+	report("dispatch/string+rtti", nodes * rounds, t2 - t1);
+	ratio("dispatch/speedup", (t2 - t1) / (t1 - t0), std::to_string(vars));
+
+	t0 = now();
+	auto tree_types = typecheck(root, symbols, status);
+	t1 = now();
+	auto flat_ast = flatten(root);
+	t2 = now();
+	auto flat_types = typecheck(flat_ast, symbols, status);
+	double t3 = now();
+	SymbolTable fused_symbols;
+	Lexer fused_lex(source, fused_symbols, status);
+	auto fused_types = parseAndTypecheck(fused_lex, status);
+	double t4 = now();
+	if (!status.ok()) {
+		std::printf("%s\n", status.message.c_str());
+		return false;
+	}
+	if (tree_types != flat_types || tree_types != fused_types) {
+		std::printf("typecheck engines disagree\n");
+		return false;
+	}
+	report("typecheck/tree", nodes, t1 - t0);
+	report("typecheck/flatten", nodes, t2 - t1);
+	report("typecheck/flat", nodes, t3 - t2);
+	report("typecheck/fused+parse", nodes, t4 - t3);
+
+	t0 = now();
+	std::string out;
+	processLine(source, out, symbols, status);
+	t1 = now();
+	report("end-to-end", nodes, t1 - t0);
+	return true;
+}
+
+// keeps the compiler from dropping unused results
+volatile long long sink;
+
+void benchUnionFind() {
+	Status status;
+	for (int n = 1 << 16; n <= 1 << 22; n <<= 2) {
+		std::string size = "/" + std::to_string(n);
+		// chain: join each element to the next one, as a let chain does
+		double t0 = now();
+		UnionFind a(n);
+		for (int i = 0; i + 1 < n; i++) {
+			unify(a, i, i + 1, status);
+		}
+		unify(a, 0, INT, status);
+		long long sum = 0;
+		for (int i = 0; i < n; i++) {
+			sum += a.find(i);
+		}
+		double t1 = now();
+		// reverse chain: join each element to the previous one
+		UnionFind b(n);
+		for (int i = n - 1; i > 0; i--) {
+			unify(b, i, i - 1, status);
+		}
+		for (int i = 0; i < n; i++) {
+			sum += b.find(i);
+		}
+		double t2 = now();
+		// pairs, then pairs of pairs, ...: balanced merges of ever larger classes
+		UnionFind c(n);
+		for (int step = 1; step < n; step <<= 1) {
+			for (int i = 0; i + step < n; i += 2 * step) {
+				unify(c, i + step, i, status);
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			sum += c.find(i);
+		}
+		double t3 = now();
+		// pairs again on an UndoUnionFind, then rolled back
+		UndoUnionFind d(n);
+		auto start = d.checkpoint();
+		for (int step = 1; step < n; step <<= 1) {
+			for (int i = 0; i + step < n; i += 2 * step) {
+				unify(d, i + step, i, status);
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			sum += d.find(i);
+		}
+		double t4 = now();
+		long long changes = d.trail.size();
+		d.rollback(start);
+		double t5 = now();
+		if (d.n != n || d.find(n - 1) != n - 1) {
+			std::printf("rollback left a join\n");
+		}
+		report(("unionfind/chain" + size).c_str(), 2LL * n, t1 - t0, "ops");
+		report(("unionfind/reverse" + size).c_str(), 2LL * n, t2 - t1, "ops");
+		report(("unionfind/pairs" + size).c_str(), 2LL * n, t3 - t2, "ops");
+		report(("undo/pairs" + size).c_str(), 2LL * n, t4 - t3, "ops");
+		report(("undo/rollback" + size).c_str(), changes, t5 - t4, "changes");
+		sink = sum;
+	}
+}
+
+// the same classes, up to the names of their roots
+template<typename A, typename B>
+bool samePartition(A &a, B &b, int n) {
+	std::vector<int> root_of(n, -1); // by root in a: the root in b
+	for (int i = 0; i < n; i++) {
+		int &r = root_of[a.find(i)];
+		if (r == -1) {
+			r = b.find(i);
+		} else if (r != b.find(i)) {
+			return false;
+		}
+	}
+	std::vector<int> seen(n, -1); // by root in b: the root in a
+	for (int i = 0; i < n; i++) {
+		int &r = seen[b.find(i)];
+		if (r == -1) {
+			r = a.find(i);
+		} else if (r != a.find(i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// ConcurrentUnionFind with 1, 2, 4, ... threads, each joining its share of the pairs, against UnionFind
+bool benchConcurrentUnionFind() {
+	const int n = 1 << 22;
+	int cores = std::max(4u, std::thread::hardware_concurrency());
+	// random pairs touch random classes, so threads rarely meet; hot pairs all join the class of 0
+	std::vector<std::pair<int, int>> random_pairs(n), hot_pairs(n);
+	unsigned x = 1;
+	for (int i = 0; i < n; i++) {
+		x = x * 1103515245u + 12345u;
+		int a = (x >> 8) % n;
+		x = x * 1103515245u + 12345u;
+		random_pairs[i] = std::make_pair(a, static_cast<int>((x >> 8) % n));
+		hot_pairs[i] = std::make_pair(i, 0);
+	}
+	struct Workload {
+		const char *name;
+		const std::vector<std::pair<int, int>> &pairs;
+	};
+	Workload workloads[] = {{"random", random_pairs}, {"hot", hot_pairs}};
+	Status status;
+	for (const Workload &w : workloads) {
+		std::string name = std::string("concurrent/") + w.name + "/";
+		double t0 = now();
+		UnionFind expected(n);
+		for (const auto &p : w.pairs) {
+			unify(expected, p.first, p.second, status);
+		}
+		double t1 = now();
+		report((name + "sequential").c_str(), n, t1 - t0, "ops");
+		double base = t1 - t0;
+		for (int jobs = 1; jobs <= cores; jobs *= 2) {
+			t0 = now();
+			ConcurrentUnionFind uf(n);
+			std::vector<std::thread> threads;
+			for (int j = 0; j < jobs; j++) {
+				threads.emplace_back([&uf, &w, j, jobs]() -> void {
+					Status st;
+					for (std::size_t i = j; i < w.pairs.size(); i += jobs) {
+						unify(uf, w.pairs[i].first, w.pairs[i].second, st);
+					}
+				});
+			}
+			for (auto &t : threads) {
+				t.join();
+			}
+			t1 = now();
+			if (!samePartition(expected, uf, n)) {
+				std::printf("ConcurrentUnionFind differs from UnionFind on %s with %d threads\n", w.name, jobs);
+				return false;
+			}
+			report((name + "jobs=" + std::to_string(jobs)).c_str(), n, t1 - t0, "ops");
+			ratio(name + "speedup/" + std::to_string(jobs), base / (t1 - t0));
+		}
+	}
+
+	// proper types: the threads give the class of 0 the same type many times, and then each tries the other type
+	ConcurrentUnionFind uf(n);
+	std::vector<std::thread> threads;
+	std::vector<char> conflicts(cores);
+	for (int j = 0; j < cores; j++) {
+		threads.emplace_back([&uf, &conflicts, &hot_pairs, j, cores]() -> void {
+			Status st;
+			for (std::size_t i = j; i < hot_pairs.size(); i += cores) {
+				unify(uf, hot_pairs[i].first, hot_pairs[i].second, st);
+				if (i == static_cast<std::size_t>(j) || i % 4096 == 0) { // before the conflict below
+					unify(uf, hot_pairs[i].first, INT, st);
+				}
+			}
+			conflicts[j] = !unify(uf, j, BOOL, st);
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	if (std::count(conflicts.begin(), conflicts.end(), 0) != 0 || uf.type[uf.find(n - 1)] != INT) {
+		std::printf("ConcurrentUnionFind lost a proper type\n");
+		return false;
+	}
+	return true;
+}
+
+void benchChains() {
+	for (int n = 1 << 10; n <= 1 << 14; n <<= 1) {
+		std::string size = "/" + std::to_string(n);
+		std::string lets = genLetChain(n);
+		std::string ifs = genIfChain(n);
+		std::string shadows = genShadowChain(n);
+		SymbolTable symbols;
+		Status status;
+		Lexer let_tokens(lets, symbols, status);
+		Lexer if_tokens(ifs, symbols, status);
+		double t0 = now();
+		parseAndTypecheck(let_tokens, status);
+		double t1 = now();
+		parseAndTypecheck(if_tokens, status);
+		double t2 = now();
+		symbols.clear();
+		Lexer shadow_tokens(shadows, symbols, status);
+		double t3 = now();
+		parseAndTypecheck(shadow_tokens, status);
+		double t4 = now();
+		report(("chain/let" + size).c_str(), 3LL * n + 1, t1 - t0);
+		report(("chain/if" + size).c_str(), 5LL * n + 1, t2 - t1);
+		report(("chain/shadow" + size).c_str(), 3LL * n + 1, t4 - t3);
+	}
+}
+
+void benchDepth() {
+	for (int n = 1 << 10; n <= 1 << 20; n <<= 2) {
+		std::string size = "/" + std::to_string(n);
+		std::string source = genSubChain(n);
+		long long nodes = 2LL * n + 1;
+		SymbolTable symbols;
+		Status status;
+		Arena arena;
+		double t0 = now();
+		Lexer lex(source, symbols, status);
+		auto root = parse(lex, arena, status);
+		double t1 = now();
+		typecheck(root, symbols, status);
+		double t2 = now();
+		auto flat_ast = flatten(root);
+		typecheck(flat_ast, symbols, status);
+		double t3 = now();
+		Lexer fused_lex(source, symbols, status);
+		parseAndTypecheck(fused_lex, status);
+		double t4 = now();
+		report(("depth/parse" + size).c_str(), nodes, t1 - t0);
+		report(("depth/tree" + size).c_str(), nodes, t2 - t1);
+		report(("depth/flatten+flat" + size).c_str(), nodes, t3 - t2);
+		report(("depth/fused+parse" + size).c_str(), nodes, t4 - t3);
+	}
+}
+
+bool benchBatch(int lines) {
+	// small independent expressions of varying depth, with a type error every 16 lines
+	std::string text;
+	for (int i = 0; i < lines; i++) {
+		int id = i;
+		if (i % 16 == 15) {
+			text += "(- true ";
+			genInt(i % 6, id, text);
+			text += ")";
+		} else {
+			genInt(i % 8, id, text);
+		}
+		text += '\n';
+	}
+	int cores = std::max(4u, std::thread::hardware_concurrency());
+	std::string expected;
+	double base = 0;
+	for (int jobs = 1; jobs <= cores; jobs *= 2) {
+		std::string out;
+		std::vector<BatchWorker> workers(jobs);
+		double t0 = now();
+		processLines(text.data(), text.size(), workers, out);
+		double t1 = now();
+		if (jobs == 1) {
+			expected = out;
+			base = t1 - t0;
+		} else if (out != expected) {
+			std::printf("batch output depends on the number of threads\n");
+			return false;
+		}
+		report(("batch/jobs=" + std::to_string(jobs)).c_str(), lines, t1 - t0, "lines");
+		ratio("batch/speedup/" + std::to_string(jobs), base / (t1 - t0));
+	}
+
+	// The lines repeat a few shapes under different names, so nearly all of them hit the cache.
+	std::string out;
+	std::vector<BatchWorker> workers;
+	workers.emplace_back(1024);
+	double t0 = now();
+	processLines(text.data(), text.size(), workers, out);
+	double t1 = now();
+	if (out != expected) {
+		std::printf("cached batch output differs\n");
+		return false;
+	}
+	report("batch/cached", lines, t1 - t0, "lines");
+	ratio("batch/cache-speedup", base / (t1 - t0),
+		std::to_string(workers[0].cache.hits) + " hits, " + std::to_string(workers[0].cache.misses) + " misses");
+	return true;
+}
+
+bool benchIncremental(int depth) {
+	int id = 0;
+	std::string source;
+	genInt(depth, id, source);
+	// edits of one literal near the start, in the middle and near the end, each made and then undone
+	struct Edit {
+		const char *name;
+		std::size_t at;
+	};
+	Edit edits[] = {{"start", source.find('1')}, {"middle", source.find('1', source.size() / 2)},
+		{"end", source.rfind('1')}};
+	const int rounds = 20;
+
+	SymbolTable symbols;
+	Status status;
+	IncrementalChecker checker;
+	SymbolTypes types = checker.check(source, status);
+	for (const Edit &edit : edits) {
+		std::string edited = source;
+		edited[edit.at] = '2';
+		double t0 = now();
+		for (int i = 0; i < rounds; i++) {
+			check(i % 2 == 0 ? edited : source, symbols, status);
+		}
+		double t1 = now();
+		long long reused = checker.reused, rechecked = checker.rechecked;
+		for (int i = 0; i < rounds; i++) {
+			types = checker.check(i % 2 == 0 ? edited : source, status);
+		}
+		double t2 = now();
+		if (!status.ok() || types != check(source, symbols, status)) {
+			std::printf("incremental check differs from check()\n");
+			return false;
+		}
+		report(("incremental/full/" + std::string(edit.name)).c_str(), source.size() * rounds, t1 - t0, "bytes");
+		report(("incremental/edit/" + std::string(edit.name)).c_str(), source.size() * rounds, t2 - t1, "bytes");
+		ratio("incremental/speedup/" + std::string(edit.name), (t1 - t0) / (t2 - t1),
+			std::to_string(checker.reused - reused) + " reused, " + std::to_string(checker.rechecked - rechecked) +
+			" rechecked tokens");
+	}
+
+	// Random edits near one place in a large random expression, which mostly stay in the region of the ones before:
+	// a word replaced by one of the same type, by a leaf or by a small expression, or now and then a mutation, and
+	// now and then a move to somewhere else. An edit is kept if it checks, and undone by the next one if not. The
+	// types and their names, or the error, must be those of check().
+	Random r;
+	source.clear();
+	genRandom(r, 1 << 14, INT, 0, source);
+	static const char *leaves[] = {"1", "-42", "a", "b", "p", "true", "false", "h", "u"};
+	const int changes = 1 << 10;
+	IncrementalChecker local;
+	local.check(source, status);
+	std::size_t near = source.size() / 2;
+	long long rechecked = 0, reused = 0;
+	double seconds = 0;
+	for (int i = 0; i < changes; i++) {
+		if (r.below(64) == 0) {
+			near = r.below(source.size() + 1);
+		}
+		std::size_t at = std::min(source.size(), near - std::min<std::size_t>(near, 128) + r.below(256));
+		while (at < source.size() && !(std::isalnum(static_cast<unsigned char>(source[at]))
+			&& (at == 0 || !std::isalnum(static_cast<unsigned char>(source[at - 1]))))) {
+			at++;
+		}
+		std::size_t to = at;
+		while (to < source.size() && std::isalnum(static_cast<unsigned char>(source[to]))) {
+			to++;
+		}
+		std::string edited = source, word;
+		if (r.below(8) == 0) {
+			mutate(r, edited);
+		} else if (r.below(4) == 0) {
+			genRandom(r, 1 + r.below(8), r.below(2) ? INT : BOOL, 8, word);
+		} else if (r.below(2) == 0) {
+			word = leaves[r.below(sizeof leaves / sizeof leaves[0])];
+		} else if (at < to && std::isdigit(static_cast<unsigned char>(source[at]))) {
+			word = std::to_string(r.below(100));
+		} else if (to - at == 1 && source[at] >= 'a' && source[at] <= 's') { // another variable of its type
+			word = std::string(1, "abcdpqrs"[(source[at] >= 'p') * 4 + r.below(4)]);
+		}
+		if (!word.empty()) {
+			edited.replace(at, to - at, word);
+		}
+		long long before = local.rechecked, before_reused = local.reused;
+		Status incremental;
+		double t0 = now();
+		types = local.check(edited, incremental);
+		seconds += now() - t0;
+		rechecked += local.rechecked - before;
+		reused += local.reused - before_reused;
+		SymbolTypes expected = check(edited, symbols, status);
+		std::string out, reference;
+		if (incremental.ok() && status.ok()) {
+			formatTypes(types, local.symbols(), out);
+			formatTypes(expected, symbols, reference);
+			source = edited;
+		}
+		if (incremental.kind != status.kind || incremental.position != status.position
+			|| incremental.message != status.message || out != reference) {
+			std::printf("incremental check of an edit differs from check() on %s\n", edited.c_str());
+			return false;
+		}
+	}
+	report("incremental/nearby", changes, seconds, "edits");
+	fraction("incremental/nearby/rechecked", rechecked, rechecked + reused, "tokens");
+	return true;
+}
+
+// each phase of the pipeline on one generated input; the type check may fail, but only with a type error
+bool benchPhases(const std::string &family, const std::string &source) {
+	std::string name = "phases/" + family + "/";
+	SymbolTable symbols;
+	Status status;
+
+	long long a0 = allocations;
+	double t0 = now();
+	Lexer tokens(source, symbols, status);
+	while (tokens.next().kind != TokenKind::End) {
+	}
+	double t1 = now();
+	report((name + "tokenize").c_str(), source.size(), t1 - t0, "bytes", allocations - a0);
+
+	Arena arena;
+	a0 = allocations;
+	t0 = now();
+	symbols.clear();
+	Lexer lex(source, symbols, status);
+	auto root = parse(lex, arena, status);
+	t1 = now();
+	if (!status.ok()) {
+		std::printf("%s\n", status.message.c_str());
+		return false;
+	}
+	long long nodes = 0;
+	dfs(root, [&nodes](Node *) -> bool {
+		nodes++;
+		return true;
+	});
+	report((name + "parse").c_str(), nodes, t1 - t0, "nodes", allocations - a0);
+
+	Status tree_status, flat_status, fused_status;
+	a0 = allocations;
+	t0 = now();
+	auto tree_types = typecheck(root, symbols, tree_status);
+	t1 = now();
+	long long a1 = allocations;
+	auto flat_ast = flatten(root);
+	double t2 = now();
+	long long a2 = allocations;
+	auto flat_types = typecheck(flat_ast, symbols, flat_status);
+	double t3 = now();
+	long long a3 = allocations;
+	SymbolTable fused_symbols;
+	Lexer fused_lex(source, fused_symbols, fused_status);
+	auto fused_types = parseAndTypecheck(fused_lex, fused_status);
+	double t4 = now();
+	long long a4 = allocations;
+	// The engines unify in different orders, so they may name the two sides of a type error the other way around.
+	if (tree_types != flat_types || tree_types != fused_types || tree_status.kind != flat_status.kind ||
+		tree_status.kind != fused_status.kind) {
+		std::printf("typecheck engines disagree on %s\n", family.c_str());
+		return false;
+	}
+	if (!tree_status.ok() && tree_status.kind != ErrorKind::Type) {
+		std::printf("%s\n", tree_status.message.c_str());
+		return false;
+	}
+	report((name + "typecheck/tree").c_str(), nodes, t1 - t0, "nodes", a1 - a0);
+	report((name + "flatten").c_str(), nodes, t2 - t1, "nodes", a2 - a1);
+	report((name + "typecheck/flat").c_str(), nodes, t3 - t2, "nodes", a3 - a2);
+	report((name + "fused+parse").c_str(), nodes, t4 - t3, "nodes", a4 - a3);
+	report((name + "fused+parse").c_str(), source.size(), t4 - t3, "bytes");
+	return true;
+}
+
+// the expression families, each with about 2^log_size nodes
+bool benchFamilies(int log_size) {
+	int n = 1 << log_size;
+	int id = 0;
+	std::string mixed, ifs, vars;
+	genInt(log_size, id, mixed);
+	id = 0;
+	genIfTree(std::max(1, log_size - 2), id, ifs);
+	id = 0;
+	genVarTree(log_size - 1, id, vars);
+	struct Family {
+		const char *name;
+		std::string source;
+	};
+	Family families[] = {{"mixed", mixed}, {"sub-chain", genSubChain(n / 2)}, {"if-tree", ifs},
+		{"let-chain", genLetChain(n / 3)}, {"vars", vars}, {"type-error", genSubError(n / 2)}};
+	for (const Family &f : families) {
+		if (!benchPhases(f.name, f.source)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool benchParallel(int log_size) {
+	int id = 0;
+	std::string mixed, ifs, vars;
+	genInt(log_size, id, mixed);
+	id = 0;
+	genIfTree(std::max(1, log_size - 2), id, ifs);
+	id = 0;
+	genVarTree(log_size - 1, id, vars);
+	struct Family {
+		const char *name;
+		std::string source;
+	};
+	Family families[] = {{"mixed", mixed}, {"if-tree", ifs}, {"vars", vars}};
+	int cores = std::max(4u, std::thread::hardware_concurrency());
+	for (const Family &f : families) {
+		std::string name = std::string("parallel/") + f.name + "/";
+		SymbolTable symbols;
+		Status status;
+		Arena arena;
+		Lexer lex(f.source, symbols, status);
+		auto ast = flatten(parse(lex, arena, status));
+		double t0 = now();
+		auto expected = typecheck(ast, symbols, status);
+		double t1 = now();
+		if (!status.ok()) {
+			std::printf("%s\n", status.message.c_str());
+			return false;
+		}
+		report((name + "typecheck/flat").c_str(), ast.size(), t1 - t0);
+		double base = t1 - t0;
+		for (int jobs = 1; jobs <= cores; jobs *= 2) {
+			t0 = now();
+			auto types = typecheckParallel(ast, symbols, status, jobs);
+			t1 = now();
+			if (!status.ok() || types != expected) {
+				std::printf("typecheckParallel() differs from typecheck() on %s\n", f.name);
+				return false;
+			}
+			report((name + "jobs=" + std::to_string(jobs)).c_str(), ast.size(), t1 - t0);
+			ratio(name + "speedup/" + std::to_string(jobs), base / (t1 - t0));
+		}
+	}
+	return true;
+}
+
+bool benchImage(int log_size) {
+	int id = 0;
+	std::string source;
+	genInt(log_size, id, source);
+	SymbolTable symbols;
+	Status status;
+	double t0 = now();
+	SymbolTypes expected = check(source, symbols, status);
+	double t1 = now();
+	Arena arena;
+	symbols.clear();
+	Lexer lex(source, symbols, status);
+	auto ast = flatten(parse(lex, arena, status));
+	SymbolTypes types = typecheck(ast, symbols, status);
+	double t2 = now();
+	std::string image;
+	writeAstImage(ast, symbols, &types, image);
+	double t3 = now();
+	AstImage loaded;
+	std::string error;
+	if (!loaded.load(image.data(), image.size(), error)) {
+		std::printf("%s\n", error.c_str());
+		return false;
+	}
+	double t4 = now();
+	SymbolTypes rechecked = typecheck(loaded, status);
+	double t5 = now();
+	SymbolTypes stored(loaded.types, loaded.types + loaded.symbols);
+	double t6 = now();
+	std::string stored_out, expected_out;
+	formatTypes(stored, loaded, stored_out);
+	formatTypes(expected, symbols, expected_out);
+	if (!status.ok() || types != expected || rechecked != expected || stored_out != expected_out) {
+		std::printf("AST image differs from the source\n");
+		return false;
+	}
+	report("image/check-source", source.size(), t1 - t0, "bytes");
+	report("image/parse+flatten+typecheck", source.size(), t2 - t1, "bytes");
+	report("image/write", image.size(), t3 - t2, "bytes");
+	report("image/load", image.size(), t4 - t3, "bytes");
+	report("image/typecheck", ast.size(), t5 - t4);
+	report("image/stored-types", loaded.symbols, t6 - t5, "syms");
+	ratio("image/speedup/typecheck", (t1 - t0) / (t5 - t3), "load + typecheck against check()");
+	ratio("image/speedup/stored-types", (t1 - t0) / (t6 - t5 + t4 - t3), "load + stored types against check()");
+	ratio("image/size", static_cast<double>(image.size()) / source.size(), "image bytes per source byte");
+	return true;
+}
+
+// let va = (- x 1), let vb = (- va 1), ...: each declaration uses the previous one
+std::vector<std::string> genDeclarations(int n) {
+	std::vector<std::string> lines;
+	std::string prev = "x";
+	for (int i = 0; i < n; i++) {
+		lines.push_back("let " + nameOf(i) + " = (- " + prev + " 1)");
+		prev = nameOf(i);
+	}
+	return lines;
+}
+
+bool benchSession(int max_lines) {
+	std::string out;
+	Status status;
+	for (int n = 1 << 10; n <= max_lines; n *= 2) {
+		std::vector<std::string> lines = genDeclarations(n);
+		Session session;
+		double t0 = now();
+		for (const std::string &line : lines) {
+			out.clear();
+			if (!session.processLine(line, out, status)) {
+				std::printf("%s\n", status.message.c_str());
+				return false;
+			}
+		}
+		double t1 = now();
+		report(("session/declare/" + std::to_string(n)).c_str(), n, t1 - t0, "lines");
+		if (2 * n <= max_lines) {
+			continue;
+		}
+
+		// the same program squashed into one line: (let va = (- x 1) in (let vb = (- va 1) in ... (- vz 1)))
+		std::string last = "(- " + nameOf(n - 1) + " 1)", squashed;
+		for (int i = 0; i < n; i++) {
+			squashed += "(let " + nameOf(i) + " = (- " + (i == 0 ? std::string("x") : nameOf(i - 1)) + " 1) in ";
+		}
+		squashed += last + std::string(n, ')');
+		const int rounds = 1000, squashed_rounds = 10;
+		t0 = now();
+		for (int i = 0; i < rounds; i++) {
+			out.clear();
+			session.processLine(last, out, status);
+		}
+		t1 = now();
+		SymbolTable symbols;
+		Status squashed_status;
+		SymbolTypes types;
+		for (int i = 0; i < squashed_rounds; i++) {
+			types = check(squashed, symbols, squashed_status);
+		}
+		double t2 = now();
+		if (!status.ok() || !squashed_status.ok() || typeOf(types, symbols, nameOf(n - 1)) != INT ||
+			out != nameOf(n - 1) + " :: INT\n") {
+			std::printf("session and squashed program disagree\n");
+			return false;
+		}
+		report("session/append", rounds, t1 - t0, "lines");
+		report("session/squashed", squashed_rounds, t2 - t1, "lines");
+		ratio("session/append-speedup", (t2 - t1) / squashed_rounds / ((t1 - t0) / rounds),
+			std::to_string(n) + " declarations before the line");
+	}
+	return true;
+}
+
+// (&& C0 (! (&& C1 (! ... last)))): n comparisons in chains of 64, each chain but the first under a ! that is the last
+// child of its parent, so that the subtrees split off by typecheckParallel() end in one
+std::string genNegatedChain(int n, const std::string &last) {
+	std::string s, chain = genComparisons(64, true);
+	int chains = std::max(1, n / 64);
+	for (int i = 0; i < chains; i++) {
+		s += "(&& " + chain + " (! ";
+	}
+	s += last;
+	for (int i = 0; i < chains; i++) {
+		s += "))";
+	}
+	return s;
+}
+
+// typecheckParallel() against typecheck() on the flat AST of source, with 1, 2 and 4 threads
+bool parallelAgrees(const std::string &source) {
+	SymbolTable symbols;
+	Status status, expected_status;
+	Arena arena;
+	Lexer lex(source, symbols, status);
+	auto ast = flatten(parse(lex, arena, status));
+	auto expected = typecheck(ast, symbols, expected_status);
+	for (int jobs = 1; jobs <= 4; jobs *= 2) {
+		Status st;
+		auto types = typecheckParallel(ast, symbols, st, jobs);
+		if (st.kind != expected_status.kind || st.message != expected_status.message
+			|| (expected_status.ok() && types != expected)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool benchOperators(int n) {
+	std::string native = genComparisons(n, true), encoded = genComparisons(n, false);
+	SymbolTable symbols;
+	Status status;
+	Stats native_stats, encoded_stats;
+	SymbolTypes types = check(native.data(), native.size(), symbols, status, native_stats);
+	std::string expected, out;
+	formatTypes(types, symbols, expected);
+	types = check(encoded.data(), encoded.size(), symbols, status, encoded_stats);
+	formatTypes(types, symbols, out);
+	if (!status.ok() || out != expected) {
+		std::printf("native operators and their encodings disagree\n");
+		return false;
+	}
+	// a large expression split by typecheckParallel() with the subtrees of ! among its parts; with the given last
+	// operand well-typed and then not
+	if (!parallelAgrees(genNegatedChain(n, "false")) || !parallelAgrees(genNegatedChain(n, "(< va 1)"))
+		|| !parallelAgrees(genNegatedChain(n, "(+ va false)"))) {
+		std::printf("typecheckParallel() differs from typecheck() under !\n");
+		return false;
+	}
+	const int rounds = 20;
+	double t0 = now();
+	for (int i = 0; i < rounds; i++) {
+		check(native, symbols, status);
+	}
+	double t1 = now();
+	for (int i = 0; i < rounds; i++) {
+		check(encoded, symbols, status);
+	}
+	double t2 = now();
+	report("operators/native", native_stats.nodes * rounds, t1 - t0);
+	report("operators/encoded", encoded_stats.nodes * rounds, t2 - t1);
+	ratio("operators/nodes", static_cast<double>(encoded_stats.nodes) / native_stats.nodes, "encoded per native");
+	ratio("operators/speedup", (t2 - t1) / (t1 - t0), std::to_string(n) + " comparisons, native against encoded");
+	return true;
+}
+
+/*
+ * Whether the engines other than typecheck(Node*) agree with it on source: they must find the same types, or fail with
+ * the same kind of error. Where parse() fails, check(), the cache and the incremental checker (through which every
+ * expression is also checked) must fail at the same place with the same message, or at a type error before it. On a
+ * disagreement, the first engine that disagrees is in failure.
+ */
+bool crossCheck(const std::string &source, CheckCache &cache, IncrementalChecker &incremental, Status &reference,
+	std::string &failure) {
+	SymbolTable symbols;
+	Arena arena;
+	reference = Status();
+	Lexer lex(source, symbols, reference);
+	Node *root = parse(lex, arena, reference);
+	SymbolTypes expected = root ? typecheck(root, symbols, reference) : SymbolTypes();
+	auto agrees = [&](const char *engine, const SymbolTypes &types, const Status &status, bool front_end) -> bool {
+		bool same = status.kind == reference.kind;
+		if (same && reference.ok()) {
+			same = types == expected;
+		} else if (front_end && reference.kind != ErrorKind::Type) {
+			// A fused check unifies while it parses, so it may stop at a type error before the syntax error.
+			same = same ? status.message == reference.message && status.position == reference.position
+				: status.kind == ErrorKind::Type && status.position < reference.position;
+		}
+		if (!same) {
+			failure = engine;
+		}
+		return same;
+	};
+
+	SymbolTable checked;
+	Status status;
+	SymbolTypes types = check(source, checked, status);
+	if (!agrees("check()", types, status, true)) {
+		return false;
+	}
+	types = cache.check(source.data(), source.size(), checked, status);
+	if (!agrees("CheckCache", types, status, true)) {
+		return false;
+	}
+	types = incremental.check(source, status);
+	if (!agrees("IncrementalChecker", types, status, true)) {
+		return false;
+	}
+	if (!root) {
+		return true;
+	}
+	FlatAst flat = flatten(root);
+	types = typecheck(flat, symbols, status);
+	if (!agrees("typecheck(FlatAst)", types, status, false)) {
+		return false;
+	}
+	types = typecheckParallel(flat, symbols, status, 3);
+	if (!agrees("typecheckParallel()", types, status, false)) {
+		return false;
+	}
+	std::string bytes;
+	writeAstImage(flat, symbols, nullptr, bytes);
+	std::vector<std::uint32_t> aligned(bytes.size() / 4 + 1);
+	std::memcpy(aligned.data(), bytes.data(), bytes.size());
+	AstImage image;
+	std::string error;
+	status = Status();
+	types = image.load(reinterpret_cast<const char*>(aligned.data()), bytes.size(), error) ? typecheck(image, status)
+		: SymbolTypes();
+	return agrees("typecheck(AstImage)", types, status, false);
+}
+
+bool benchFuzz(int samples) {
+	Random r;
+	CheckCache cache(64);
+	IncrementalChecker incremental;
+	std::string text, expected, source, failure;
+	long long ill_typed = 0, ill_formed = 0;
+	double t0 = now();
+	for (int i = 0; i < samples; i++) {
+		// Most are small; every 64th is large enough for typecheckParallel() to split.
+		int budget = i % 64 == 63 ? 1 << 14 : 1 + r.below(48);
+		source.clear();
+		genRandom(r, budget, r.below(2) ? INT : BOOL, r.below(3) == 0 ? 4 * budget : 0, source);
+		if (r.below(4) == 0) {
+			Status unedited;
+			incremental.check(source, unedited); // so that the edit is checked from the last state before it
+			mutate(r, source);
+		}
+		Status reference;
+		if (!crossCheck(source, cache, incremental, reference, failure)) {
+			std::printf("fuzz: %s disagrees with typecheck() on %s\n", failure.c_str(), source.c_str());
+			return false;
+		}
+		ill_typed += reference.kind == ErrorKind::Type;
+		ill_formed += reference.kind == ErrorKind::Syntax || reference.kind == ErrorKind::Token;
+		text += source + "\n";
+		SymbolTable symbols;
+		SymbolTypes types = check(source, symbols, reference);
+		if (reference.ok()) {
+			formatTypes(types, symbols, expected);
+		} else {
+			expected += reference.message + "\n";
+		}
+		expected += "\n";
+	}
+	double t1 = now();
+
+	// the same expressions through the batch checker, as lines
+	std::string out;
+	std::vector<BatchWorker> workers;
+	workers.reserve(2);
+	workers.emplace_back(64);
+	workers.emplace_back(64);
+	processLines(text.data(), text.size(), workers, out);
+	if (out != expected) {
+		std::printf("fuzz: processLines() disagrees with check()\n");
+		return false;
+	}
+	report("fuzz/cross-check", samples, t1 - t0, "exprs");
+	fraction("fuzz/ill-typed", ill_typed, samples, "exprs");
+	fraction("fuzz/ill-formed", ill_formed, samples, "exprs");
+	return true;
+}
+
+// the engines of the scaling mode, each checking source from scratch, and the linear passes their times are divided by
+volatile unsigned scan_sum;
+
+// Read every byte, and store each word at its hash in a table with a slot per byte of the source: the least a lexer
+// does, and about as much memory traffic as interning, so its time grows with the caches as the lexer's does.
+void scaleScan(const std::string &source) {
+	std::size_t slots = 16;
+	while (slots < source.size()) {
+		slots *= 2;
+	}
+	std::vector<unsigned> table(slots);
+	unsigned sum = 0, h = 2166136261u;
+	for (std::size_t i = 0; i < source.size(); i++) {
+		unsigned char c = source[i];
+		sum = sum * 31 + c;
+		if (unsigned(c | 0x20) - 'a' < 26u) {
+			h = (h ^ c) * 16777619u;
+		} else if (h != 2166136261u) {
+			table[h & (slots - 1)] = i;
+			h = 2166136261u;
+		}
+	}
+	scan_sum = sum + table[sum & (slots - 1)];
+}
+
+void scaleLex(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	Lexer lex(source, symbols, status);
+	for (Token t = lex.next(); t.kind != TokenKind::End && t.kind != TokenKind::Error; t = lex.next()) {
+	}
+}
+
+void scaleParse(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	Arena arena;
+	Lexer lex(source, symbols, status);
+	parse(lex, arena, status);
+}
+
+void scaleCheck(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	check(source, symbols, status);
+}
+
+void scaleTree(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	Arena arena;
+	Lexer lex(source, symbols, status);
+	if (Node *root = parse(lex, arena, status)) {
+		typecheck(root, symbols, status);
+	}
+}
+
+void scaleFlat(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	Arena arena;
+	Lexer lex(source, symbols, status);
+	if (Node *root = parse(lex, arena, status)) {
+		FlatAst flat = flatten(root);
+		typecheck(flat, symbols, status);
+	}
+}
+
+void scaleParallel(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	Arena arena;
+	Lexer lex(source, symbols, status);
+	if (Node *root = parse(lex, arena, status)) {
+		typecheckParallel(flatten(root), symbols, status, 2);
+	}
+}
+
+// the source checked, then again with its first digit or x changed
+void scaleIncremental(const std::string &source) {
+	IncrementalChecker checker;
+	Status status;
+	checker.check(source, status);
+	std::string edited = source;
+	std::size_t at = edited.find_first_of("123456789x");
+	if (at != std::string::npos) {
+		edited[at] = edited[at] == 'x' ? 'y' : '0';
+	}
+	checker.check(edited, status);
+}
+
+// a miss, then a hit
+void scaleCache(const std::string &source) {
+	CheckCache cache(4);
+	SymbolTable symbols;
+	Status status;
+	cache.check(source.data(), source.size(), symbols, status);
+	cache.check(source.data(), source.size(), symbols, status);
+}
+
+// the slope of the least-squares line through the points (x[i], y[i])
+double slope(const std::vector<double> &x, const std::vector<double> &y) {
+	double mx = 0, my = 0;
+	for (std::size_t i = 0; i < x.size(); i++) {
+		mx += x[i] / x.size();
+		my += y[i] / y.size();
+	}
+	double sxy = 0, sxx = 0;
+	for (std::size_t i = 0; i < x.size(); i++) {
+		sxy += (x[i] - mx) * (y[i] - my);
+		sxx += (x[i] - mx) * (x[i] - mx);
+	}
+	return sxx > 0 ? sxy / sxx : 0;
+}
+
+/*
+ * Each engine on every family of inputs at doubling sizes from 2^11 nodes to 2^log_size. The peak of the bytes live
+ * during a check, and its time divided by the time of parse() on the same input, are fitted to c * n^k over the sizes;
+ * k may be at most max_exponent on any family. The raw time of even a linear pass grows as n^1.15 or so here, as the
+ * inputs outgrow the caches, but the time of parse() grows as much, so the ratio of a linear engine stays within a few
+ * hundredths of n^1, while an n log n one is about n^1.1 over the default range and a quadratic one n^2.
+ * The references are bounded in turn: the lexer's time divided by that of scaleScan() by max_exponent, and the time of
+ * parse() divided by the lexer's, which allocates nothing and so cancels the caches less well (up to n^1.1 on the
+ * larger ranges), by max_reference_exponent, which a parser of n^1.5 or worse crosses. So that a regression shared by
+ * an engine and its references still shows, the raw time of every engine is bounded by max_absolute_exponent as well,
+ * which cache effects stay below and n^1.5 crosses.
+ */
+bool benchScaling(int log_size) {
+	const int smallest = 11;
+	const double max_exponent = 1.07;
+	const double max_reference_exponent = 1.25;
+	const double max_absolute_exponent = 1.3;
+	log_size = std::max(log_size, smallest + 1);
+#if defined(__GLIBC__)
+	// Keep freed blocks in the heap, rather than mapping the large ones afresh on every run, which would fault in new
+	// pages for the larger sizes only.
+	mallopt(M_MMAP_THRESHOLD, 32 << 20);
+	mallopt(M_TRIM_THRESHOLD, 1 << 30);
+#endif
+	struct Family {
+		const char *name;
+		std::string (*generate)(int log);
+	};
+	Family families[] = {
+		{"mixed", [](int log) -> std::string {
+			int id = 0;
+			std::string s;
+			genInt(log - 2, id, s);
+			return s;
+		}},
+		{"sub-chain", [](int log) -> std::string {
+			return genSubChain((1 << log) / 2);
+		}},
+		{"let-chain", [](int log) -> std::string {
+			return genLetChain((1 << log) / 3);
+		}},
+		{"shadow-chain", [](int log) -> std::string {
+			return genShadowChain((1 << log) / 3);
+		}},
+		{"if-chain", [](int log) -> std::string {
+			return genIfChain((1 << log) / 3);
+		}},
+		{"vars", [](int log) -> std::string {
+			int id = 0;
+			std::string s;
+			genVarTree(log - 1, id, s);
+			return s;
+		}},
+		{"comparisons", [](int log) -> std::string {
+			return genComparisons((1 << log) / 8, true);
+		}},
+	};
+	struct Engine {
+		const char *name;
+		void (*run)(const std::string &source);
+		int reference; // the engine whose time this one's is divided by, or -1
+		double max_time; // the bound on the exponent of that ratio
+		double worst_time, worst_absolute, worst_memory; // the largest exponents
+		const char *worst_time_family, *worst_absolute_family, *worst_memory_family;
+	};
+	Engine engines[] = {{"scan", scaleScan, -1, max_exponent, 0, 0, 0, "", "", ""},
+		{"lex", scaleLex, 0, max_exponent, 0, 0, 0, "", "", ""},
+		{"parse", scaleParse, 1, max_reference_exponent, 0, 0, 0, "", "", ""},
+		{"check", scaleCheck, 2, max_exponent, 0, 0, 0, "", "", ""},
+		{"tree", scaleTree, 2, max_exponent, 0, 0, 0, "", "", ""},
+		{"flat", scaleFlat, 2, max_exponent, 0, 0, 0, "", "", ""},
+		{"parallel", scaleParallel, 2, max_exponent, 0, 0, 0, "", "", ""},
+		{"incremental", scaleIncremental, 2, max_exponent, 0, 0, 0, "", "", ""},
+		{"cache", scaleCache, 2, max_exponent, 0, 0, 0, "", "", ""}};
+	const int count = sizeof engines / sizeof engines[0];
+	for (const Family &f : families) {
+		// log2 of the nodes, and of the seconds and the peak bytes of each engine, at each size
+		std::vector<std::string> sources;
+		std::vector<double> sizes;
+		std::vector<int> rounds;
+		std::vector<std::vector<double>> times(count), peaks(count);
+		for (int log = smallest; log <= log_size; log++) {
+			sources.push_back(f.generate(log));
+			SymbolTable symbols;
+			Status status;
+			Stats stats;
+			check(sources.back().data(), sources.back().size(), symbols, status, stats);
+			sizes.push_back(std::log2(stats.nodes));
+			// every size checks about as many nodes in all, so that the small ones are timed as precisely
+			rounds.push_back(std::max(1LL, (1LL << log_size) / stats.nodes));
+			for (int e = 0; e < count; e++) {
+				long long base = live_bytes;
+				peak_bytes = base;
+				engines[e].run(sources.back());
+				peaks[e].push_back(std::log2(std::max(1LL, peak_bytes - base)));
+				times[e].push_back(1e30);
+			}
+		}
+		// The best of a few runs of each size, taken in turns so that a slow moment hits only one run of each.
+		for (int rep = 0; rep < 5; rep++) {
+			for (std::size_t i = 0; i < sources.size(); i++) {
+				for (int e = 0; e < count; e++) {
+					double t0 = now();
+					for (int j = 0; j < rounds[i]; j++) {
+						engines[e].run(sources[i]);
+					}
+					times[e][i] = std::min(times[e][i], std::log2((now() - t0) / rounds[i]));
+				}
+			}
+		}
+		for (int e = 0; e < count; e++) {
+			Engine &engine = engines[e];
+			std::vector<double> relative = times[e];
+			if (engine.reference != -1) {
+				for (std::size_t i = 0; i < relative.size(); i++) {
+					relative[i] -= times[engine.reference][i];
+				}
+			}
+			double time = slope(sizes, relative) + (engine.reference != -1 ? 1 : 0);
+			double absolute = slope(sizes, times[e]), memory = slope(sizes, peaks[e]);
+			if (time > engine.worst_time) {
+				engine.worst_time = time;
+				engine.worst_time_family = f.name;
+			}
+			if (absolute > engine.worst_absolute) {
+				engine.worst_absolute = absolute;
+				engine.worst_absolute_family = f.name;
+			}
+			if (memory > engine.worst_memory) {
+				engine.worst_memory = memory;
+				engine.worst_memory_family = f.name;
+			}
+		}
+	}
+	bool ok = true;
+	std::string range = "2^" + std::to_string(smallest) + " to 2^" + std::to_string(log_size) + " nodes";
+	for (const Engine &engine : engines) {
+		std::string name = std::string("scaling/") + engine.name;
+		if (engine.reference != -1) {
+			exponent(name + "/time", engine.worst_time, std::string("per ") + engines[engine.reference].name +
+				", worst on " + engine.worst_time_family + ", " + range);
+		}
+		exponent(name + "/raw-time", engine.worst_absolute,
+			"worst on " + std::string(engine.worst_absolute_family) + ", " + range);
+		exponent(name + "/peak-memory", engine.worst_memory,
+			"worst on " + std::string(engine.worst_memory_family) + ", " + range);
+		// The table of scaleScan() doubles at other sizes than the inputs, so only its time is bounded.
+		bool bounded = engine.reference != -1;
+		if ((bounded && (engine.worst_time > engine.max_time || engine.worst_memory > max_exponent)) ||
+			engine.worst_absolute > max_absolute_exponent) {
+			std::printf("scaling: %s grows faster than linearly\n", engine.name);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	std::vector<char*> args(argv, argv + argc);
+	auto flag = std::find(args.begin(), args.end(), std::string("--csv"));
+	if (flag != args.end()) {
+		csv = true;
+		args.erase(flag);
+		std::printf("name,items,unit,seconds,rate,allocs\n");
+	}
+	argc = args.size();
+	argv = args.data();
+	std::string mode = argc > 1 ? argv[1] : "all";
+	if (mode == "tree" || mode == "all") {
+		if (!benchTree(argc > 2 ? std::atoi(argv[2]) : 16)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "families" || mode == "all") {
+		if (!benchFamilies(argc > 2 && mode == "families" ? std::atoi(argv[2]) : 18)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "unionfind" || mode == "all") {
+		benchUnionFind();
+		if (!benchConcurrentUnionFind()) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "chain" || mode == "all") {
+		benchChains();
+	}
+	if (mode == "depth" || mode == "all") {
+		benchDepth();
+	}
+	if (mode == "batch" || mode == "all") {
+		if (!benchBatch(argc > 2 && mode == "batch" ? std::atoi(argv[2]) : 1 << 16)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "incremental" || mode == "all") {
+		if (!benchIncremental(argc > 2 && mode == "incremental" ? std::atoi(argv[2]) : 16)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "parallel" || mode == "all") {
+		if (!benchParallel(argc > 2 && mode == "parallel" ? std::atoi(argv[2]) : 20)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "image" || mode == "all") {
+		if (!benchImage(argc > 2 && mode == "image" ? std::atoi(argv[2]) : 20)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "session" || mode == "all") {
+		if (!benchSession(argc > 2 && mode == "session" ? std::atoi(argv[2]) : 1 << 16)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "operators" || mode == "all") {
+		if (!benchOperators(argc > 2 && mode == "operators" ? std::atoi(argv[2]) : 1 << 14)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "fuzz" || mode == "all") {
+		if (!benchFuzz(argc > 2 && mode == "fuzz" ? std::atoi(argv[2]) : 1 << 14)) {
+			return EXIT_FAILURE;
+		}
+	}
+	if (mode == "scaling" || mode == "all") {
+		if (!benchScaling(argc > 2 && mode == "scaling" ? std::atoi(argv[2]) : 17)) {
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
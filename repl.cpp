@@ -1,874 +1,730 @@
 /*
- * # Grammar (LL1)
- * <expr> := <variable> # any non-empty alphabetic sequences except for boolean literals and keywords
- *                      # duplicate variable names are not supported
- *         | <integer> # 0 | 1 | -1 | ...
- *                     # - 1 is invalid. The digits must immediately follow the negative sign.
- *         | <boolean> # true | false
- *         | ( - <expr1> <expr2> )
- *         | ( * <expr1> <expr2> )
- *         | ( / <expr1> <expr2> )
- *         | ( < <expr1> <expr2> )
- *         | ( if <expr1> then <expr2> else <expr3> )
- *         | ( let <variable> = <expr1> in <expr2> )
- *
- * # Type Constraints ([] represents the whole expression)
- * <variable>                               :
- * <integer>                                : [] = INT
- * <boolean>                                : [] = BOOL
- * ( - <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
- * ( * <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
- * ( / <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
- * ( < <expr1> <expr2> )                    : [] = BOOL, [<expr1>] = [<expr2>] = INT
- * ( if <expr1> then <expr2> else <expr3> ) : [] = [<expr2>], [<expr1>] = BOOL, [<expr2>] = [<expr3>]
- * ( let <variable> = <expr1> in <expr2> )  : [] = [<expr2>], [<variable>] = [<expr1>]
+ * The REPL: reads expressions and prints the type of every variable in them, using libtypeinfer.
+ * The language is described in typeinfer.h.
  */
 
-/*
- * Other common operators can be easily implemented:
- * (+ a b) := (- a (- 0 b))
- * (&& <expr1> <expr2>) := (if <expr1> then <expr2> else false)
- * (|| <expr1> <expr2>) := (if <expr1> then true else <expr2>)
- * (! <expr>) := (if <expr> then false else true)
- * (<= a b) := (! (< b a))
- * (> a b) := (< b a)
- * (>= a b) := (<= b a)
- * (== a b) := (&& (! (< a b)) (! (< b a)))
- * (!= a b) := (! (== a b))
- * ...
- */
+#include "typeinfer.h"
 
 #include <iostream>
-#include <vector>
-#include <string>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
 #include <map>
-#include <set>
-#include <utility>
-#include <memory>
-#include <cctype>
-#include <cstdlib>
-#include <queue>
-
-// print an error message and quit
-void die(const std::string &s) {
-	std::cerr << s << std::endl;
-	std::exit(EXIT_FAILURE);
-}
-
-// ================================================== tokenizing =================================================
-
-struct Token {
-	Token() {}
-	virtual std::string getType() {
-		return "Token";
-	}
-	virtual std::string getLiteral() {
-		return "";
-	}
-	virtual ~Token() {}
-};
-
-// variable name
-struct N : public Token {
-	N(const std::string &val0) : val(val0) {}
-	std::string getType() override {
-		return "N";
-	}
-	std::string getLiteral() override {
-		return val;
-	}
-	~N() override {}
-
-	std::string val;
-};
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace typeinfer;
 
-// integer literal
-struct I : public Token {
-	I(int val0) : val(val0) {}
-	std::string getType() override {
-		return "I";
-	}
-	std::string getLiteral() override {
-		return std::to_string(val);
+/*
+ * The interactive loop: prompt for each line and quit on the first error; each line is checked as an edit of the last
+ * one. With stats, each line is checked in full instead, and its stats line goes to stderr after its types.
+ */
+int runInteractive(bool stats) {
+	std::string line, out;
+	IncrementalChecker checker;
+	SymbolTable symbols;
+	Status status;
+	while (true) {
+		std::cout << "...> " << std::flush;
+		if (!getline(std::cin, line)) {
+			return EXIT_SUCCESS;
+		}
+		out.clear();
+		if (stats) {
+			Stats line_stats;
+			bool ok = processLine(line, out, symbols, status, line_stats);
+			std::cout << out << std::flush;
+			out.clear();
+			line_stats.format(out);
+			std::cerr << out;
+			if (!ok) {
+				std::cerr << status.message << std::endl;
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+		SymbolTypes types = checker.check(line, status);
+		if (!status.ok()) {
+			std::cerr << status.message << std::endl;
+			return EXIT_FAILURE;
+		}
+		formatTypes(types, checker.symbols(), out);
+		std::cout << out;
 	}
-	~I() override {}
-
-	int val;
-};
+}
 
-// boolean literal
-struct B : public Token {
-	B(bool val0) : val(val0) {}
-	std::string getType() override {
-		return "B";
-	}
-	std::string getLiteral() override {
-		if (val) {
-			return "true";
+/*
+ * The session loop: like the interactive loop, but the lines share one Session, and an error only loses its line.
+ * Without a prompt, each line produces a record as in the batch loop.
+ */
+int runSession(std::istream &in, bool prompt) {
+	std::string line, out;
+	Session session;
+	Status status;
+	while (true) {
+		if (prompt) {
+			std::cout << "...> " << std::flush;
+		}
+		if (!getline(in, line)) {
+			std::cout.flush();
+			return EXIT_SUCCESS;
+		}
+		out.clear();
+		if (session.processLine(line, out, status)) {
+			std::cout << out;
+		} else if (prompt) {
+			std::cerr << status.message << std::endl;
 		} else {
-			return "false";
+			std::cout << status.message << '\n';
+		}
+		if (!prompt) {
+			std::cout << '\n';
 		}
 	}
-	~B() override {}
-
-	bool val;
-};
-
-// reserved token
-struct K : public Token {
-	K(const std::string &val0) : val(val0) {}
-	std::string getType() override {
-		return "K";
-	}
-	std::string getLiteral() override {
-		return val;
-	}
-	~K() override {}
-
-	std::string val;
-};
+}
 
 /*
- * variable names: [a-zA-Z]+
- * boolean literal: true | false
- * integer literal: -?[0-9]+
- * reserved tokens: ( ) - * / < if then else let = in
+ * The batch loop: one expression per line, no prompts.
+ * Every input line produces one record on the output: its "name :: TYPE" lines (or its error message),
+ * followed by an empty line. Errors do not stop the batch.
+ * The input is read in windows of whole lines, each checked by processLines() on jobs threads, each of which
+ * caches up to cache_size results. With stats, the results are not cached, and the stats of the whole batch go to
+ * stderr at the end.
  */
-
-// is alphabetic or not
-bool isa(char ch) {
-	return std::isalpha(static_cast<unsigned char>(ch));
-}
-
-// is digit or not
-bool isd(char ch) {
-	return std::isdigit(static_cast<unsigned char>(ch));
-}
-
-// is whitespace or not
-bool iss(char ch) {
-	return std::isspace(static_cast<unsigned char>(ch));
-}
-
-std::queue<Token*> tokenize(const std::string &source) {
-	std::queue<Token*> ret;
-	int n = source.size();
-	int i = 0;
-	while (i < n) {
-		if (iss(source[i])) { // ignore all whitespace characters
-			i++;
-			continue;
-		}
-		if (isa(source[i])) { // starting with English letters
-			std::string word;
-			while (i < n && isa(source[i])) {
-				word.push_back(source[i++]);
-			}
-			if (word == "true") {
-				ret.push(new B(true));
-			} else if (word == "false") {
-				ret.push(new B(false));
-			} else if (word == "if") {
-				ret.push(new K("if"));
-			} else if (word == "then") {
-				ret.push(new K("then"));
-			} else if (word == "else") {
-				ret.push(new K("else"));
-			} else if (word == "let") {
-				ret.push(new K("let"));
-			} else if (word == "in") {
-				ret.push(new K("in"));
-			} else { // Actually, several previous branches can be merged to this one.
-				ret.push(new N(word));
-			}
-		} else { // starting with other characters
-			switch (source[i]) {
-			case '(':
-				ret.push(new K("("));
-				i++;
-				break;
-			case ')':
-				ret.push(new K(")"));
-				i++;
-				break;
-			case '-': // the subtraction operator or the negative sign
-				if (i + 1 < n && isd(source[i + 1])) {
-					i++;
-					std::string num = "-";
-					while (i < n && isd(source[i])) {
-						num.push_back(source[i++]);
-					}
-					ret.push(new I(std::stoi(num)));
-				} else {
-					ret.push(new K("-"));
-					i++;
-				}
-				break;
-			case '*':
-				ret.push(new K("*"));
-				i++;
-				break;
-			case '/':
-				ret.push(new K("/"));
-				i++;
-				break;
-			case '<':
-				ret.push(new K("<"));
-				i++;
-				break;
-			case '=':
-				ret.push(new K("="));
-				i++;
-				break;
-			default: // nonnegative digits or other characters
-				std::string num;
-				while (isd(source[i])) {
-					num.push_back(source[i++]);
-				}
-				if (num.size() == 0) { // other characters
-					die(std::string("Token Error: unrecognized character '")
-						+ source[i]
-						+ std::string("' at position ")
-						+ std::to_string(i));
-				} else {
-					ret.push(new I(std::stoi(num)));
-				}
-				break;
+int runBatch(std::istream &in, int jobs, std::size_t cache_size, bool stats) {
+	std::vector<BatchWorker> workers;
+	workers.reserve(jobs);
+	for (int j = 0; j < jobs; j++) {
+		workers.emplace_back(cache_size);
+		workers.back().measure = stats;
+	}
+	std::vector<char> window(1 << 24);
+	std::size_t filled = 0;
+	std::string out;
+	while (true) {
+		in.read(window.data() + filled, window.size() - filled);
+		filled += in.gcount();
+		bool eof = !in;
+		std::size_t end = filled; // the end of the last whole line in the window
+		if (!eof) {
+			while (end > 0 && window[end - 1] != '\n') {
+				end--;
 			}
 		}
+		if (end > 0) {
+			processLines(window.data(), end, workers, out);
+			std::cout.write(out.data(), out.size());
+			out.clear();
+			std::memmove(window.data(), window.data() + end, filled - end);
+			filled -= end;
+		}
+		if (eof) {
+			break;
+		}
+		if (filled == window.size()) { // one line fills the window
+			window.resize(2 * window.size());
+		}
 	}
-	return ret;
-}
-
-void printTokens(const std::queue<Token*> &tokens) {
-	std::queue<Token*> ts = tokens;
-	while (!ts.empty()) {
-		auto t = ts.front();
-		std::cout << t->getLiteral() << std::endl;
-		ts.pop();
+	std::cout.flush();
+	if (stats) {
+		Stats total;
+		for (auto &w : workers) {
+			total.add(w.stats);
+		}
+		total.format(out);
+		std::cerr << out;
 	}
+	return EXIT_SUCCESS;
 }
 
-// =========================================== parsing ================================================
-
-struct Node {
-	Node() {}
-	virtual std::string getType() {
-		return "Node";
-	}
-	virtual std::string getLiteral() {
-		return "";
+// a whole file, mapped read-only; an empty file maps to an empty string
+struct MappedFile {
+	~MappedFile() {
+		if (size > 0) {
+			munmap(const_cast<char*>(data), size);
+		}
+	}
+	bool open(const char *file_name) {
+		int fd = ::open(file_name, O_RDONLY);
+		if (fd < 0) {
+			std::cerr << "cannot open " << file_name << std::endl;
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			std::cerr << "cannot open " << file_name << std::endl;
+			close(fd);
+			return false;
+		}
+		if (st.st_size > 0) {
+			void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED) {
+				std::cerr << "cannot map " << file_name << std::endl;
+				close(fd);
+				return false;
+			}
+			data = static_cast<const char*>(map);
+			size = st.st_size;
+		}
+		close(fd);
+		return true;
 	}
-	virtual ~Node() {}
 
-	// the pre-order BFS number
-	int number = -1;
+	const char *data = "";
+	std::size_t size = 0;
 };
 
-struct Var : public Node {
-	Var(const std::string &val0) : val(val0) {}
-	std::string getType() override {
-		return "Var";
-	}
-	std::string getLiteral() override {
-		return "[Var " + val + "]";
-	}
-	~Var() override {}
-
-	std::string val;
-};
+/*
+ * The file loop: batch mode on the expressions of a file, which may span lines. The file is mapped rather than read,
+ * and checked in windows of whole expressions (but at least one expression) with processExpressions(); the pages of
+ * each window are dropped once it is done, so only the window being checked is resident.
+ */
+int runFile(const char *file_name, int jobs, std::size_t cache_size, bool stats) {
+	MappedFile file;
+	if (!file.open(file_name)) {
+		return EXIT_FAILURE;
+	}
+	madvise(const_cast<char*>(file.data), file.size, MADV_SEQUENTIAL);
+	const char *text = file.data;
+	std::size_t size = file.size;
+
+	std::vector<BatchWorker> workers;
+	workers.reserve(jobs);
+	for (int j = 0; j < jobs; j++) {
+		workers.emplace_back(cache_size);
+		workers.back().measure = stats;
+	}
+	const std::size_t window = 1 << 24;
+	const std::size_t page = sysconf(_SC_PAGESIZE);
+	const char *begin = text, *end = text + size;
+	std::string out;
+	while (begin < end) {
+		const char *stop = begin;
+		do {
+			stop = skipSpaces(stop, end);
+			if (stop < end) {
+				stop = expressionEnd(stop, end);
+			}
+		} while (stop < end && static_cast<std::size_t>(stop - begin) < window);
+		processExpressions(begin, stop - begin, workers, out);
+		std::cout.write(out.data(), out.size());
+		out.clear();
+		// the whole pages before stop
+		const char *first = text + (begin - text) / page * page, *last = text + (stop - text) / page * page;
+		if (first < last) {
+			madvise(const_cast<char*>(first), last - first, MADV_DONTNEED);
+		}
+		begin = stop;
+	}
+	std::cout.flush();
+	if (stats) {
+		Stats total;
+		for (auto &w : workers) {
+			total.add(w.stats);
+		}
+		total.format(out);
+		std::cerr << out;
+	}
+	return EXIT_SUCCESS;
+}
 
-struct Int : public Node {
-	Int(int val0) : val(val0) {}
-	std::string getType() override {
-		return "Int";
-	}
-	std::string getLiteral() override {
-		return "[Int " + std::to_string(val) + "]";
+/*
+ * Parse the expression in source_name, print its record, and unless it has a token or syntax error, write its AST
+ * image to image_name, with the solved types if it has no type error.
+ */
+int saveImage(const char *source_name, const char *image_name) {
+	MappedFile source;
+	if (!source.open(source_name)) {
+		return EXIT_FAILURE;
+	}
+	SymbolTable symbols;
+	Status status;
+	Arena arena;
+	Lexer lex(source.data, source.size, symbols, status);
+	Node *root = parse(lex, arena, status);
+	if (!status.ok()) {
+		std::cout << status.message << "\n\n";
+		return EXIT_FAILURE;
+	}
+	FlatAst ast = flatten(root);
+	SymbolTypes types = typecheck(ast, symbols, status);
+	std::string out;
+	writeAstImage(ast, symbols, status.ok() ? &types : nullptr, out);
+	std::ofstream image(image_name, std::ios::binary);
+	if (!image.write(out.data(), out.size())) {
+		std::cerr << "cannot write " << image_name << std::endl;
+		return EXIT_FAILURE;
+	}
+	out.clear();
+	if (status.ok()) {
+		formatTypes(types, symbols, out);
+	} else {
+		out = status.message + "\n";
 	}
-	~Int() override {}
-
-	int val;
-};
+	std::cout << out << "\n";
+	return EXIT_SUCCESS;
+}
 
-struct Bool : public Node {
-	Bool(bool val0) : val(val0) {}
-	std::string getType() override {
-		return "Bool";
+/*
+ * Print the record of the expression of an AST image, from its stored types if it has them (and check is false), or
+ * else by checking it on jobs threads.
+ */
+int loadImage(const char *image_name, int jobs, bool check) {
+	MappedFile file;
+	if (!file.open(image_name)) {
+		return EXIT_FAILURE;
+	}
+	AstImage image;
+	std::string error;
+	if (!image.load(file.data, file.size, error)) {
+		std::cerr << image_name << ": " << error << std::endl;
+		return EXIT_FAILURE;
+	}
+	Status status;
+	SymbolTypes types;
+	if (image.types != nullptr && !check) {
+		types.assign(image.types, image.types + image.symbols);
+	} else {
+		types = jobs > 1 ? typecheckParallel(image, status, jobs) : typecheck(image, status);
 	}
-	std::string getLiteral() override {
-		return "[Bool " + std::string(val ? "true" : "false") + "]";
+	std::string out;
+	if (status.ok()) {
+		formatTypes(types, image, out);
+	} else {
+		out = status.message + "\n";
 	}
-	~Bool() override {}
-
-	bool val;
-};
+	std::cout << out << "\n";
+	return EXIT_SUCCESS;
+}
 
-struct Sub : public Node {
-	Sub(Node *n10, Node *n20) : n1(n10), n2(n20) {}
-	std::string getType() override {
-		return "Sub";
-	}
-	std::string getLiteral() override {
-		return "[Sub " + n1->getLiteral() + " " + n2->getLiteral() + "]";
-	}
-	~Sub() override {
-		delete n1;
-		delete n2;
-	}
+// ================================================ server ============================================================
 
-	Node *n1, *n2;
-};
+/*
+ * The server protocol, over a Unix socket or stdin/stdout: each request is one line "ID EXPRESSION", where ID is any
+ * token without spaces; each response is a line "ID" followed by the record of the expression, as in batch mode.
+ * An empty ID (an empty line, or one that starts with a space) gets an empty ID line and an error record.
+ * A client may send any number of requests without waiting. They are checked on the worker threads, and the
+ * responses of a connection come back in the order of its requests. A last line without '\n' is a request too unless
+ * it is empty.
+ *
+ * A request line longer than MAX_REQUEST_LINE gets an error record, and then its connection is closed. A connection is
+ * not read while it has MAX_PENDING_OUTPUT bytes of responses unwritten or MAX_PENDING_REQUESTS requests unanswered,
+ * so a client that sends without reading holds only that much of the server's memory.
+ */
+const std::size_t MAX_REQUEST_LINE = 1 << 24, MAX_PENDING_OUTPUT = 1 << 22;
+const long long MAX_PENDING_REQUESTS = 1 << 12;
 
-struct Mul : public Node {
-	Mul(Node *n10, Node *n20) : n1(n10), n2(n20) {}
-	std::string getType() override {
-		return "Mul";
-	}
-	std::string getLiteral() override {
-		return "[Mul " + n1->getLiteral() + " " + n2->getLiteral() + "]";
-	}
-	~Mul() override {
-		delete n1;
-		delete n2;
-	}
+struct Connection {
+	Connection(int in0, int out0) : in(in0), out(out0) {}
 
-	Node *n1, *n2;
-};
+	int in, out; // the same socket, or stdin and stdout
+	std::string input; // read, up to the end of the last whole request
+	std::string output; // responses to write
+	long long requests = 0; // read so far
+	long long responses = 0; // moved to output so far
+	std::map<long long, std::string> done; // checked but not yet in output, by request; guarded by Server::lock
+	bool eof = false; // nothing more to read
+	bool broken = false; // the client is gone, so responses are dropped
 
-struct Div : public Node {
-	Div(Node *n10, Node *n20) : n1(n10), n2(n20) {}
-	std::string getType() override {
-		return "Div";
-	}
-	std::string getLiteral() override {
-		return "[Div " + n1->getLiteral() + " " + n2->getLiteral() + "]";
-	}
-	~Div() override {
-		delete n1;
-		delete n2;
+	// whether to read more requests now, or first write the responses to the ones before
+	bool reading() const {
+		return !eof && output.size() < MAX_PENDING_OUTPUT && requests - responses < MAX_PENDING_REQUESTS;
 	}
-
-	Node *n1, *n2;
 };
 
-struct Lt : public Node {
-	Lt(Node *n10, Node *n20) : n1(n10), n2(n20) {}
-	std::string getType() override {
-		return "Lt";
-	}
-	std::string getLiteral() override {
-		return "[Lt " + n1->getLiteral() + " " + n2->getLiteral() + "]";
-	}
-	~Lt() override {
-		delete n1;
-		delete n2;
-	}
-
-	Node *n1, *n2;
+struct Request {
+	Connection *connection;
+	long long number;
+	std::string id, expression;
 };
 
-struct If : public Node {
-	If(Node *n10, Node *n20, Node *n30) : n1(n10), n2(n20), n3(n30) {}
-	std::string getType() override {
-		return "If";
-	}
-	std::string getLiteral() override {
-		return "[If " + n1->getLiteral() + " " + n2->getLiteral() + " " + n3->getLiteral() + "]";
-	}
-	~If() override {
-		delete n1;
-		delete n2;
-		delete n3;
-	}
-
-	Node *n1, *n2, *n3;
-};
+static volatile std::sig_atomic_t stop_signal = 0;
+static volatile std::sig_atomic_t stop_wake = -1; // the write end of the running server's wake pipe, or -1
 
-struct Let : public Node {
-	Let(Node *n10, Node *n20, Node *n30) : n1(n10), n2(n20), n3(n30) {}
-	std::string getType() override {
-		return "Let";
-	}
-	std::string getLiteral() override {
-		return "[Let " + n1->getLiteral() + " " + n2->getLiteral() + " " + n3->getLiteral() + "]";
-	}
-	~Let() override {
-		delete n1;
-		delete n2;
-		delete n3;
+// also wake the server's poll(), which would otherwise sleep through a signal that arrives just before it
+static void onStopSignal(int) {
+	stop_signal = 1;
+	int fd = stop_wake;
+	if (fd != -1) {
+		char byte = 0;
+		if (write(fd, &byte, 1) < 0) { // the pipe is full, so the main loop will wake anyway
+		}
 	}
+}
 
-	Node *n1, *n2, *n3;
-};
-
-/*
- * <expr> := <variable> # any non-empty alphabetic sequences except for boolean literals and keywords
- *                      # duplicate variable names are not supported
- *         | <integer> # 0 | 1 | -1 | ...
- *                     # - 1 is invalid. The digits must immediately follow the negative sign.
- *         | <boolean> # true | false
- *         | ( - <expr1> <expr2> )
- *         | ( * <expr1> <expr2> )
- *         | ( / <expr1> <expr2> )
- *         | ( < <expr1> <expr2> )
- *         | ( if <expr1> then <expr2> else <expr3> )
- *         | ( let <variable> = <expr1> in <expr2> )
- */
-
-// mutually recursive functions
-Node *parseHead(std::queue<Token*> &q);
-Node *parseTail(std::queue<Token*> &q);
-
-Node *parseHead(std::queue<Token*> &q) {
-	if (q.empty()) {
-		die("Syntax Error: Expressions and subexpressions cannot be empty.");
-	}
-	Token *cur = q.front();
-	q.pop();
-	if (cur->getType() == "N") { // <variable>
-		return new Var(cur->getLiteral());
-	} else if (cur->getType() == "I") { // <integer>
-		return new Int(std::stoi(cur->getLiteral()));
-	} else if (cur->getType() == "B") { // <boolean>
-		if (cur->getLiteral() == "true") {
-			return new Bool(true);
-		} else {
-			return new Bool(false);
+struct Server {
+	Server(int jobs, std::size_t cache_size) {
+		workers.reserve(jobs);
+		for (int j = 0; j < jobs; j++) {
+			workers.emplace_back(cache_size);
 		}
-	} else if (cur->getType() == "K") { // left parenthesis (
-		if (cur->getLiteral() == "(") {
-			return parseTail(q);
-		} else {
-			die("Syntax Error: Expressions and subexpressions cannot start with token " + cur->getLiteral());
+		if (pipe(wake) != 0) {
+			wake[0] = wake[1] = -1;
+			error = std::string("cannot create a pipe: ") + std::strerror(errno);
+			return;
+		}
+		fcntl(wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake[1], F_SETFL, O_NONBLOCK);
+		for (auto &w : workers) {
+			threads.emplace_back(&Server::work, this, &w);
 		}
-	} else { // This branch is for the Token type.
-		die("Syntax Error: Expressions and subexpressions cannot start with token type " + cur->getType());
 	}
-}
-
-Node *parseTail(std::queue<Token*> &q) {
-	if (q.empty()) {
-		die("Syntax Error: Expressions and subexpressions cannot be (.");
-	}
-	Token *cur = q.front();
-	q.pop();
-	if (cur->getLiteral() == "-") { // ( - <expr1> <expr2> )
-		auto n1 = parseHead(q);
-		auto n2 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing ) in (- <expr1> <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != ")") {
-				die("Syntax Error: missing ) in (- <expr1> <expr2>)");
-			}
+	~Server() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
 		}
-		return new Sub(n1, n2);
-	} else if (cur->getLiteral() == "*") { // ( * <expr1> <expr2> )
-		auto n1 = parseHead(q);
-		auto n2 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing ) in (* <expr1> <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != ")") {
-				die("Syntax Error: missing ) in (* <expr1> <expr2>)");
-			}
+		ready.notify_all();
+		for (auto &t : threads) {
+			t.join();
 		}
-		return new Mul(n1, n2);
-	} else if (cur->getLiteral() == "/") { // ( / <expr1> <expr2> )
-		auto n1 = parseHead(q);
-		auto n2 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing ) in (/ <expr1> <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != ")") {
-				die("Syntax Error: missing ) in (/ <expr1> <expr2>)");
-			}
+		if (wake[0] != -1) {
+			close(wake[0]);
+			close(wake[1]);
 		}
-		return new Div(n1, n2);
-	} else if (cur->getLiteral() == "<") { // ( < <expr1> <expr2> )
-		auto n1 = parseHead(q);
-		auto n2 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing ) in (< <expr1> <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != ")") {
-				die("Syntax Error: missing ) in (< <expr1> <expr2>)");
+	}
+
+	// a worker thread: check requests until the server stops, keeping its worker (and so its cache) warm
+	void work(BatchWorker *w) {
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			ready.wait(guard, [this]() -> bool {
+				return stopping || !queue.empty();
+			});
+			if (queue.empty()) {
+				return;
 			}
-		}
-		return new Lt(n1, n2);
-	} else if (cur->getLiteral() == "if") { // ( if <expr1> then <expr2> else <expr3> )
-		auto n1 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing 'then' in (if <expr1> then <expr2> else <expr3>)");
-		} else {
-			auto t = q.front();
-			q.pop();
-			if (t->getLiteral() != "then") {
-				die("Syntax Error: missing 'then' in (if <expr1> then <expr2> else <expr3>)");
+			Request r = std::move(queue.front());
+			queue.pop_front();
+			guard.unlock();
+			std::string response = r.id + "\n";
+			try {
+				processRecord(r.expression.data(), r.expression.size(), response, *w);
+			} catch (const std::bad_alloc &) { // an expression too large for memory fails alone
+				response = r.id + "\nError: out of memory\n\n";
 			}
-		}
-		auto n2 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing 'else' in (if <expr1> then <expr2> else <expr3>)");
-		} else {
-			auto t = q.front();
-			q.pop();
-			if (t->getLiteral() != "else") {
-				die("Syntax Error: missing 'else' in (if <expr1> then <expr2> else <expr3>)");
+			guard.lock();
+			r.connection->done[r.number] = std::move(response);
+			char byte = 0;
+			if (write(wake[1], &byte, 1) < 0) { // the pipe is full, so the main loop will wake anyway
 			}
 		}
-		auto n3 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing ) in (if <expr1> then <expr2> else <expr3>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != ")") {
-				die("Syntax Error: missing ) in (if <expr1> then <expr2> else <expr3>)");
+	}
+
+	// queue the whole requests in the input of c
+	void readRequests(Connection &c) {
+		std::size_t begin = 0;
+		std::vector<Request> requests;
+		std::vector<long long> anonymous; // the numbers of the requests without an ID
+		while (true) {
+			std::size_t nl = c.input.find('\n', begin);
+			if (nl == std::string::npos) {
+				break;
 			}
-		}
-		return new If(n1, n2, n3);
-	} else if (cur->getLiteral() == "let") { // ( let <variable> = <expr1> in <expr2> )
-		auto n1 = parseHead(q);
-		if (n1->getType() != "Var") {
-			die("Syntax Error: The token following 'let' must be a variable.");
-		}
-		if (q.empty()) {
-			die("Syntax Error: missing = in (let <variable> = <expr1> in <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != "=") {
-				die("Syntax Error: missing = in (let <variable> = <expr1> in <expr2>)");
+			std::size_t end = nl > begin && c.input[nl - 1] == '\r' ? nl - 1 : nl;
+			std::size_t space = std::min(c.input.find(' ', begin), end);
+			if (space == begin) { // an empty ID, which could not tell the response apart
+				anonymous.push_back(c.requests++);
+				begin = nl + 1;
+				continue;
 			}
-		}
-		auto n2 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing 'in' in (let <variable> = <expr1> in <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != "in") {
-				die("Syntax Error: missing 'in' in (let <variable> = <expr1> in <expr2>)");
+			Request r{&c, c.requests++, c.input.substr(begin, space - begin), ""};
+			if (space < end) {
+				r.expression = c.input.substr(space + 1, end - space - 1);
 			}
-		}
-		auto n3 = parseHead(q);
-		if (q.empty()) {
-			die("Syntax Error: missing ) in (let <variable> = <expr1> in <expr2>)");
-		} else {
-			auto r = q.front();
-			q.pop();
-			if (r->getLiteral() != ")") {
-				die("Syntax Error: missing ) in (let <variable> = <expr1> in <expr2>)");
+			requests.push_back(std::move(r));
+			begin = nl + 1;
+		}
+		c.input.erase(0, begin);
+		if (c.input.size() > MAX_REQUEST_LINE) { // answered after the requests before it, and the last one read
+			std::string id = c.input.substr(0, std::min(c.input.find(' '), std::size_t(256)));
+			c.input.clear();
+			c.eof = true;
+			std::lock_guard<std::mutex> guard(lock);
+			c.done[c.requests++] = id + "\nError: request longer than " + std::to_string(MAX_REQUEST_LINE)
+				+ " bytes\n\n";
+			char byte = 0;
+			if (write(wake[1], &byte, 1) < 0) { // the pipe is full, so the main loop will wake anyway
 			}
 		}
-		return new Let(n1, n2, n3);
-	} else {
-		die("Syntax Error: Expressions and subexpressions cannot start with ( and " + cur->getLiteral());
-	}
-}
-
-Node *parse(const std::queue<Token*> &tokens) {
-	std::queue<Token*> q = tokens;
-	return parseHead(q);
-}
-
-void printAST(Node *root) {
-	std::cout << root->getLiteral() << std::endl;
-}
-
-// =========================================== type inference and type check ==========================================
-
-struct UnionFind {
-	UnionFind(int n0) : n(n0) {
-		for (int i = 0; i < n0; i++) {
-			prev.push_back(i);
+		if (!anonymous.empty()) {
+			std::lock_guard<std::mutex> guard(lock);
+			for (long long number : anonymous) {
+				c.done[number] = "\nError: request without an ID\n\n";
+			}
+			char byte = 0;
+			if (write(wake[1], &byte, 1) < 0) { // the pipe is full, so the main loop will wake anyway
+			}
 		}
-	}
-	int find(int x) {
-		int r = x;
-		while (prev[r] != r) {
-			r = prev[r];
+		if (requests.empty()) {
+			return;
 		}
-		int i = x, j;
-		while (prev[i] != r) {
-			j = prev[i];
-			prev[i] = r;
-			i = j;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (auto &r : requests) {
+				queue.push_back(std::move(r));
+			}
 		}
-		return r;
-	}
-	void join(int x, int y) { // The second argument serves as the root.
-		prev[find(x)] = find(y);
-	}
-
-	int n;
-	std::vector<int> prev;
-};
-
-// This is a general function for traversing the AST and applying f to each node.
-template<typename F> void dfs(Node *root, F f) {
-	f(root);
-	if (root->getType() == "Sub") {
-		auto r = dynamic_cast<Sub*>(root);
-		if (r == nullptr) {
-			die("Internal Error: dynamic_cast failed from Node* to Sub*");
-		}
-		dfs(r->n1, f);
-		dfs(r->n2, f);
-	} else if (root->getType() == "Mul") {
-		auto r = dynamic_cast<Mul*>(root);
-		if (r == nullptr) {
-			die("Internal Error: dynamic_cast failed from Node* to Mul*");
-		}
-		dfs(r->n1, f);
-		dfs(r->n2, f);
-	} else if (root->getType() == "Div") {
-		auto r = dynamic_cast<Div*>(root);
-		if (r == nullptr) {
-			die("Internal Error: dynamic_cast failed from Node* to Div*");
-		}
-		dfs(r->n1, f);
-		dfs(r->n2, f);
-	} else if (root->getType() == "Lt") {
-		auto r = dynamic_cast<Lt*>(root);
-		if (r == nullptr) {
-			die("Internal Error: dynamic_cast failed from Node* to Lt*");
-		}
-		dfs(r->n1, f);
-		dfs(r->n2, f);
-	} else if (root->getType() == "If") {
-		auto r = dynamic_cast<If*>(root);
-		if (r == nullptr) {
-			die("Internal Error: dynamic_cast failed from Node* to If*");
-		}
-		dfs(r->n1, f);
-		dfs(r->n2, f);
-		dfs(r->n3, f);
-	} else if (root->getType() == "Let") {
-		auto r = dynamic_cast<Let*>(root);
-		if (r == nullptr) {
-			die("Internal Error: dynamic_cast failed from Node* to Let*");
-		}
-		dfs(r->n1, f);
-		dfs(r->n2, f);
-		dfs(r->n3, f);
+		ready.notify_all();
 	}
-}
 
-// This function does both type inference and type check.
-std::map<std::string, std::string> typecheck(Node *root) {
-	// duplicate variable name check
-	std::set<std::string> variable_names;
-	auto check_duplicate_variables = [&variable_names](Node *cur) -> void {
-		if (cur->getType() == "Let") {
-			auto c = dynamic_cast<Let*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Let*");
-			}
-			auto v = dynamic_cast<Var*>(c->n1);
-			if (v == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Var*");
-			}
-			if (variable_names.count(v->val) == 0) {
-				variable_names.insert(v->val);
-			} else {
-				die("Variable Error: Duplicate variable names are not supported.");
-			}
+	// move the responses that are next in order to the output of their connections
+	void collect() {
+		char bytes[256];
+		while (read(wake[0], bytes, sizeof bytes) > 0) {
 		}
-	};
-	dfs(root, check_duplicate_variables);
-
-	// assign numbers to AST nodes
-	int counter = 0;
-	std::map<std::string, int> variable_number_map;
-	auto assign_numbers = [&counter, &variable_number_map](Node *cur) -> void {
-		if (cur->getType() == "Var") { // Different occurances of the same variable share the same number.
-			auto c = dynamic_cast<Var*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Var*");
-			}
-			if (variable_number_map.count(c->val) == 0) {
-				c->number = counter++;
-				variable_number_map[c->val] = c->number;
-			} else {
-				c->number = variable_number_map[c->val];
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto &c : connections) {
+			for (auto it = c->done.begin(); it != c->done.end() && it->first == c->responses; it = c->done.erase(it)) {
+				if (!c->broken) {
+					c->output += it->second;
+				}
+				c->responses++;
 			}
-		} else {
-			cur->number = counter++;
 		}
-	};
-	dfs(root, assign_numbers);
+	}
 
-	// generate constraints
-	// Constraints have the form x = y, where x and y are type variables or INT or BOOL.
 	/*
-	 * # Type Constraints ([] represents the whole expression)
-	 * <variable>                               :
-	 * <integer>                                : [] = INT
-	 * <boolean>                                : [] = BOOL
-	 * ( - <expr1> <expr2> )                    : [] = INT, [<expr1>] = INT, [<expr2>] = INT
-	 * ( * <expr1> <expr2> )                    : [] = INT, [<expr1>] = INT, [<expr2>] = INT
-	 * ( / <expr1> <expr2> )                    : [] = INT, [<expr1>] = INT, [<expr2>] = INT
-	 * ( < <expr1> <expr2> )                    : [] = BOOL, [<expr1>] = INT, [<expr2>] = INT
-	 * ( if <expr1> then <expr2> else <expr3> ) : [] = [<expr2>], [<expr1>] = BOOL, [<expr2>] = [<expr3>]
-	 * ( let <variable> = <expr1> in <expr2> )  : [] = [<expr2>], [<variable>] = [<expr1>]
+	 * Serve until stopped: accept clients on listener (or, if it is -1, serve stdin and stdout until stdin ends), read
+	 * their requests and write their responses as each side is ready, without blocking on any one client.
 	 */
-#define INT (counter)
-#define BOOL (counter + 1)
-	std::vector<std::pair<int, int>> constraints;
-	// We must capture "counter" in this lambda expression, because the macros INT and BOOL are using "counter".
-	auto generate_constraints = [&counter, &constraints](Node *cur) -> void {
-		if (cur->getType() == "Var") {
-			// <variable> :
-			;
-		} else if (cur->getType() == "Int") {
-			// <integer> : [] = INT
-			constraints.push_back(std::make_pair(cur->number, INT));
-		} else if (cur->getType() == "Bool") {
-			// <boolean> : [] = BOOL
-			constraints.push_back(std::make_pair(cur->number, BOOL));
-		} else if (cur->getType() == "Sub") {
-			// ( - <expr1> <expr2> ) : [] = INT, [<expr1>] = INT, [<expr2>] = INT
-			auto c = dynamic_cast<Sub*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Sub*");
+	int run(int listener) {
+		// stdin and stdout may be shared with the shell and other processes, so their flags are restored on return
+		int in_flags = fcntl(STDIN_FILENO, F_GETFL), out_flags = fcntl(STDOUT_FILENO, F_GETFL);
+		if (listener == -1) {
+			connections.emplace_back(new Connection(STDIN_FILENO, STDOUT_FILENO));
+			fcntl(STDIN_FILENO, F_SETFL, in_flags | O_NONBLOCK);
+			fcntl(STDOUT_FILENO, F_SETFL, out_flags | O_NONBLOCK);
+		}
+		std::vector<char> buffer(1 << 16);
+		stop_wake = wake[1];
+		while (stop_signal == 0 && (listener != -1 || !connections.empty())) {
+			std::vector<pollfd> fds;
+			fds.push_back(pollfd{wake[0], POLLIN, 0});
+			if (listener != -1) {
+				fds.push_back(pollfd{listener, POLLIN, 0});
 			}
-			constraints.push_back(std::make_pair(c->number, INT));
-			constraints.push_back(std::make_pair(c->n1->number, INT));
-			constraints.push_back(std::make_pair(c->n2->number, INT));
-		} else if (cur->getType() == "Mul") {
-			// ( * <expr1> <expr2> ) : [] = INT, [<expr1>] = INT, [<expr2>] = INT
-			auto c = dynamic_cast<Mul*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Mul*");
+			for (auto &c : connections) {
+				fds.push_back(pollfd{c->reading() ? c->in : -1, POLLIN, 0}); // -1: poll() ignores it, even on hangup
+				fds.push_back(pollfd{c->output.empty() ? -1 : c->out, POLLOUT, 0});
 			}
-			constraints.push_back(std::make_pair(c->number, INT));
-			constraints.push_back(std::make_pair(c->n1->number, INT));
-			constraints.push_back(std::make_pair(c->n2->number, INT));
-		} else if (cur->getType() == "Div") {
-			// ( / <expr1> <expr2> ) : [] = INT, [<expr1>] = INT, [<expr2>] = INT
-			auto c = dynamic_cast<Div*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Div*");
+			if (poll(fds.data(), fds.size(), -1) < 0) {
+				continue; // a signal
 			}
-			constraints.push_back(std::make_pair(c->number, INT));
-			constraints.push_back(std::make_pair(c->n1->number, INT));
-			constraints.push_back(std::make_pair(c->n2->number, INT));
-		} else if (cur->getType() == "Lt") {
-			// ( < <expr1> <expr2> ) : [] = BOOL, [<expr1>] = INT, [<expr2>] = INT
-			auto c = dynamic_cast<Lt*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Lt*");
+			if (fds[0].revents != 0) {
+				collect();
 			}
-			constraints.push_back(std::make_pair(c->number, BOOL));
-			constraints.push_back(std::make_pair(c->n1->number, INT));
-			constraints.push_back(std::make_pair(c->n2->number, INT));
-		} else if (cur->getType() == "If") {
-			// ( if <expr1> then <expr2> else <expr3> ) : [] = [<expr2>], [<expr1>] = BOOL, [<expr2>] = [<expr3>]
-			auto c = dynamic_cast<If*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to If*");
+			if (listener != -1 && fds[1].revents != 0) {
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd >= 0) {
+					fcntl(fd, F_SETFL, O_NONBLOCK);
+					connections.emplace_back(new Connection(fd, fd));
+				}
 			}
-			constraints.push_back(std::make_pair(c->number, c->n2->number));
-			constraints.push_back(std::make_pair(c->n1->number, BOOL));
-			constraints.push_back(std::make_pair(c->n2->number, c->n3->number));
-		} else if (cur->getType() == "Let") {
-			// ( let <variable> = <expr1> in <expr2> ) : [] = [<expr2>], [<variable>] = [<expr1>]
-			auto c = dynamic_cast<Let*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Let*");
+			std::size_t first = listener != -1 ? 2 : 1;
+			for (std::size_t i = 0; i < connections.size() && first + 2 * i < fds.size(); i++) {
+				Connection &c = *connections[i];
+				if (fds[first + 2 * i].revents != 0) {
+					ssize_t n = read(c.in, buffer.data(), buffer.size());
+					if (n > 0) {
+						c.input.append(buffer.data(), n);
+						readRequests(c);
+					} else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+						c.eof = true;
+						if (!c.input.empty()) { // a last request without '\n'
+							c.input += '\n';
+							readRequests(c);
+						}
+					}
+				}
+				if (fds[first + 2 * i + 1].revents != 0 && !c.output.empty()) {
+					ssize_t n = write(c.out, c.output.data(), c.output.size());
+					if (n > 0) {
+						c.output.erase(0, n);
+					} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+						c.broken = c.eof = true;
+						c.output.clear();
+					}
+				}
 			}
-			constraints.push_back(std::make_pair(c->number, c->n3->number));
-			constraints.push_back(std::make_pair(c->n1->number, c->n2->number));
-		} else {
-			die("Internal Error: Unknown AST node type!");
+			closeFinished();
 		}
-	};
-	dfs(root, generate_constraints);
-
-	// a helper function
-	auto is_type_variable = [&counter](int x) -> bool {
-		// 0, 1, ..., counter - 1 are type variables.
-		// counter is INT.
-		// counter + 1 is BOOL.
-		return x < counter;
-	};
+		stop_wake = -1;
+		if (listener == -1) {
+			fcntl(STDIN_FILENO, F_SETFL, in_flags);
+			fcntl(STDOUT_FILENO, F_SETFL, out_flags);
+		}
+		return EXIT_SUCCESS;
+	}
 
-	// solve constraints
-	UnionFind uf(counter + 2);
-	for (auto p : constraints) {
-		int x = p.first;
-		int y = p.second;
-		int rx = uf.find(x);
-		int ry = uf.find(y);
-		if (is_type_variable(rx) && is_type_variable(ry)) {
-			uf.join(rx, ry);
-		} else if (is_type_variable(rx)) { // always choose the proper type as the root
-			uf.join(rx, ry);
-		} else if (is_type_variable(ry)) { // always choose the proper type as the root
-			uf.join(ry, rx);
-		} else {
-			if (rx == ry) {
-				uf.join(rx, ry);
+	// close the connections that will read no more, once every response to them is written or dropped
+	void closeFinished() {
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto it = connections.begin(); it != connections.end(); ) {
+			Connection &c = **it;
+			if (c.eof && c.responses == c.requests && c.output.empty()) {
+				if (c.in != STDIN_FILENO) {
+					close(c.in);
+				}
+				it = connections.erase(it);
 			} else {
-				std::string t_rx = (rx == INT) ? "INT" : "BOOL";
-				std::string t_ry = (ry == INT) ? "INT" : "BOOL";
-				die("Type Error: cannot unify " + t_rx + " and " + t_ry);
+				++it;
 			}
 		}
 	}
 
-	// construct variable-type map
-	std::map<std::string, std::string> ret;
-	auto add_var = [&counter, &ret, &uf](Node *cur) -> void {
-		if (cur->getType() == "Var") {
-			auto c = dynamic_cast<Var*>(cur);
-			if (c == nullptr) {
-				die("Internal Error: dynamic_cast failed from Node* to Var*");
-			}
-			std::string t;
-			if (uf.find(c->number) == INT) {
-				t = "INT";
-			} else if (uf.find(c->number) == BOOL) {
-				t = "BOOL";
-			} else {
-				t = "GENERICS-" + std::to_string(uf.find(c->number));
-			}
-			ret[c->val] = t;
+	std::vector<BatchWorker> workers;
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<Connection>> connections;
+	std::mutex lock;
+	std::condition_variable ready; // a request was queued, or the server is stopping
+	std::deque<Request> queue;
+	bool stopping = false;
+	int wake[2]; // a pipe that the workers write to when a response is done
+	std::string error; // why the server could not start, if it could not
+};
+
+/*
+ * The server loop: the protocol above on the Unix socket at path, or on stdin and stdout if path is "-", with jobs
+ * worker threads, each of which caches up to cache_size results across all requests.
+ */
+int runServer(const char *path, int jobs, std::size_t cache_size) {
+	std::signal(SIGPIPE, SIG_IGN);
+	int listener = -1;
+	if (std::strcmp(path, "-") != 0) {
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof address);
+		address.sun_family = AF_UNIX;
+		if (std::strlen(path) >= sizeof address.sun_path) {
+			std::cerr << "socket path too long: " << path << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::strcpy(address.sun_path, path);
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(path);
+		if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof address) != 0 ||
+			listen(listener, 64) != 0) {
+			std::cerr << "cannot listen on " << path << std::endl;
+			return EXIT_FAILURE;
+		}
+		fcntl(listener, F_SETFL, O_NONBLOCK);
+	}
+	// in both modes the loop has to end by itself, to close the socket or restore the flags of stdin and stdout
+	std::signal(SIGINT, onStopSignal);
+	std::signal(SIGTERM, onStopSignal);
+	int result;
+	{
+		Server server(jobs, cache_size);
+		if (!server.error.empty()) {
+			std::cerr << server.error << std::endl;
+			result = EXIT_FAILURE;
+		} else {
+			result = server.run(listener);
 		}
-	};
-	dfs(root, add_var);
-	return ret;
-#undef INT
-#undef BOOL
+	}
+	if (listener != -1) {
+		close(listener);
+		unlink(path);
+	}
+	return result;
 }
 
-int main() {
-	std::string line;
-	while (true) {
-		std::cout << "...> " << std::flush;
-		getline(std::cin, line);
-		auto tokens = tokenize(line);
-		auto ast_root = parse(tokens);
-		while (!tokens.empty()) { // release the tokens
-			auto t = tokens.front();
-			delete t;
-			tokens.pop();
-		}
-		auto variable_type_map = typecheck(ast_root);
-		for (auto p : variable_type_map) {
-			std::cout << p.first << " :: " << p.second << std::endl;
+/*
+ * repl                interactive mode (batch mode if stdin is not a terminal)
+ * repl --batch        batch mode on stdin
+ * repl --batch FILE   batch mode on FILE
+ * repl --file FILE    batch mode on the expressions of FILE, separated by any whitespace, each a record
+ * repl --save-ast SOURCE IMAGE
+ *                     check the expression in SOURCE and save its AST image (with its types) to IMAGE
+ * repl --load-ast IMAGE
+ *                     print the types stored in IMAGE (with --check: check its AST again, on --jobs threads)
+ * repl --serve PATH   serve requests on the Unix socket PATH (or on stdin and stdout if PATH is -) with --jobs
+ *                     worker threads and their --cache, until interrupted
+ * --jobs N            the number of batch threads (default: one per core)
+ * --cache N           cache the results of up to N expressions (and their alpha-equivalents) per batch thread
+ * --stats             print counters and phase times to stderr: per line, or for the whole batch
+ * --session           check the lines in order in one Session, where "let <variable> = <expr>" declares a variable
+ *                     for the later lines (--jobs, --cache and --stats do not apply)
+ */
+int main(int argc, char **argv) {
+	std::ios::sync_with_stdio(false);
+	int jobs = std::max(1u, std::thread::hardware_concurrency());
+	std::size_t cache_size = 0;
+	bool batch = !isatty(STDIN_FILENO);
+	bool stats = false;
+	bool session = false;
+	const char *file_name = nullptr;
+	bool expressions = false;
+	const char *save_source = nullptr, *image_name = nullptr;
+	bool check_image = false;
+	const char *socket_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--batch") {
+			batch = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				file_name = argv[++i];
+			}
+		} else if (arg == "--file" && i + 1 < argc) {
+			batch = expressions = true;
+			file_name = argv[++i];
+		} else if (arg == "--save-ast" && i + 2 < argc) {
+			save_source = argv[++i];
+			image_name = argv[++i];
+		} else if (arg == "--load-ast" && i + 1 < argc) {
+			image_name = argv[++i];
+		} else if (arg == "--serve" && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else if (arg == "--check") {
+			check_image = true;
+		} else if (arg == "--jobs" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+			jobs = std::atoi(argv[++i]);
+		} else if (arg == "--cache" && i + 1 < argc && std::atoi(argv[i + 1]) >= 0) {
+			cache_size = std::atoi(argv[++i]);
+		} else if (arg == "--stats") {
+			stats = true;
+		} else if (arg == "--session") {
+			session = true;
+		} else {
+			std::cerr << "usage: " << argv[0]
+				<< " [--batch [FILE] | --file FILE] [--jobs N] [--cache N] [--stats] [--session]\n"
+				<< "       " << argv[0] << " --save-ast SOURCE IMAGE | --load-ast IMAGE [--check] [--jobs N]\n"
+				<< "       " << argv[0] << " --serve PATH [--jobs N] [--cache N]" << std::endl;
+			return EXIT_FAILURE;
 		}
-		delete ast_root; // release the AST
 	}
+	if (socket_path != nullptr) {
+		return runServer(socket_path, jobs, cache_size);
+	}
+	if (save_source != nullptr) {
+		return saveImage(save_source, image_name);
+	}
+	if (image_name != nullptr) {
+		return loadImage(image_name, jobs, check_image);
+	}
+	if (expressions && !session) {
+		return runFile(file_name, jobs, cache_size, stats);
+	}
+	if (!batch) {
+		return session ? runSession(std::cin, true) : runInteractive(stats);
+	}
+	if (file_name == nullptr) {
+		return session ? runSession(std::cin, false) : runBatch(std::cin, jobs, cache_size, stats);
+	}
+	std::ifstream file(file_name, std::ios::binary);
+	if (!file) {
+		std::cerr << "cannot open " << file_name << std::endl;
+		return EXIT_FAILURE;
+	}
+	return session ? runSession(file, false) : runBatch(file, jobs, cache_size, stats);
 }
@@ -0,0 +1,2400 @@
+/*
+ * The implementation of typeinfer.h.
+ */
+
+#include "typeinfer.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace typeinfer {
+
+// ================================================== tokenizing =================================================
+
+// the classes of the characters, in the C locale; the tokenizer looks them up instead of calling <cctype>
+static const unsigned char SPACE_CHAR = 1, ALPHA_CHAR = 2, DIGIT_CHAR = 4;
+
+// 1 for whitespace, 2 for letters, 4 for digits, by 16 characters from 0; bytes from 128 on are none of them
+static const unsigned char char_classes[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0,
+	0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+	0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+};
+
+// is alphabetic or not
+static bool isa(char ch) {
+	return char_classes[static_cast<unsigned char>(ch)] & ALPHA_CHAR;
+}
+
+// is digit or not
+static bool isd(char ch) {
+	return char_classes[static_cast<unsigned char>(ch)] & DIGIT_CHAR;
+}
+
+// is whitespace or not
+static bool iss(char ch) {
+	return char_classes[static_cast<unsigned char>(ch)] & SPACE_CHAR;
+}
+
+#if defined(__SSE2__)
+// the bits of the letters among the 16 characters at p
+static unsigned alphaMask(const char *p) {
+	__m128i c = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_set1_epi8(0x20)); // lower case
+	// The comparisons are signed, so bytes from 128 on are never letters.
+	return _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1))));
+}
+
+// the bits of the whitespace characters among the 16 characters at p
+static unsigned spaceMask(const char *p) {
+	__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	__m128i controls = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+		_mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1)));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), controls));
+}
+#endif
+
+// the end of the letters from p on, at most end; 16 characters at a time with SSE2
+static const char *skipAlpha(const char *p, const char *end) {
+#if defined(__SSE2__)
+	for (; end - p >= 16; p += 16) {
+		unsigned others = ~alphaMask(p) & 0xffff;
+		if (others != 0) {
+			return p + __builtin_ctz(others);
+		}
+	}
+#endif
+	while (p < end && isa(*p)) {
+		p++;
+	}
+	return p;
+}
+
+// the end of the whitespace from p on, at most end; 16 characters at a time with SSE2
+const char *skipSpaces(const char *p, const char *end) {
+#if defined(__SSE2__)
+	for (; end - p >= 16; p += 16) {
+		unsigned others = ~spaceMask(p) & 0xffff;
+		if (others != 0) {
+			return p + __builtin_ctz(others);
+		}
+	}
+#endif
+	while (p < end && iss(*p)) {
+		p++;
+	}
+	return p;
+}
+
+template<bool intern> Token Lexer::scan() {
+	if (pos < size && iss(source[pos])) { // ignore all whitespace characters
+		pos = skipSpaces(source + pos + 1, source + size) - source;
+	}
+	std::size_t start = pos;
+	Token t;
+	t.value = 0;
+	if (pos == size) {
+		t.kind = TokenKind::End;
+	} else if (isa(source[pos])) { // starting with English letters
+		pos = skipAlpha(source + pos + 1, source + size) - source;
+		Span w{source + start, pos - start};
+		t.kind = word(w, t.value);
+		if (intern && t.kind == TokenKind::Name) {
+			t.value = symbols.intern(w);
+		}
+	} else { // starting with other characters
+		switch (source[pos]) {
+		case '(':
+			t.kind = TokenKind::LParen;
+			pos++;
+			break;
+		case ')':
+			t.kind = TokenKind::RParen;
+			pos++;
+			break;
+		case '-': // the subtraction operator or the negative sign
+			if (pos + 1 < size && isd(source[pos + 1])) {
+				t.kind = number(start, t.value);
+			} else {
+				t.kind = TokenKind::Minus;
+				pos++;
+			}
+			break;
+		case '*':
+			t.kind = TokenKind::Star;
+			pos++;
+			break;
+		case '/':
+			t.kind = TokenKind::Slash;
+			pos++;
+			break;
+		case '+':
+			t.kind = TokenKind::Plus;
+			pos++;
+			break;
+		case '<':
+			t.kind = pair('=', TokenKind::LessEqual, TokenKind::Less);
+			break;
+		case '>':
+			t.kind = pair('=', TokenKind::GreaterEqual, TokenKind::Greater);
+			break;
+		case '=':
+			t.kind = pair('=', TokenKind::EqualEqual, TokenKind::Equal);
+			break;
+		case '!':
+			t.kind = pair('=', TokenKind::NotEqual, TokenKind::Not);
+			break;
+		case '&':
+			t.kind = pair('&', TokenKind::And, TokenKind::Error);
+			break;
+		case '|':
+			t.kind = pair('|', TokenKind::Or, TokenKind::Error);
+			break;
+		default: // nonnegative digits or other characters
+			if (!isd(source[pos])) { // other characters
+				t.kind = unrecognized();
+				break;
+			}
+			t.kind = number(start, t.value);
+			break;
+		}
+	}
+	t.text = Span{source + start, pos - start};
+	return t;
+}
+
+template Token Lexer::scan<true>();
+
+bool Lexer::finish() {
+	Token t;
+	do {
+		t = scan<false>();
+	} while (t.kind != TokenKind::End && t.kind != TokenKind::Error);
+	return t.kind == TokenKind::End;
+}
+
+TokenKind Lexer::number(std::size_t start, int &value) {
+	bool negative = source[pos] == '-';
+	if (negative) {
+		pos++;
+	}
+	long long val = 0;
+	bool overflow = false;
+	while (pos < size && isd(source[pos])) {
+		val = val * 10 + (source[pos++] - '0');
+		if (val > 1LL + INT_MAX) {
+			overflow = true;
+			val = 0;
+		}
+	}
+	if (overflow || (!negative && val > INT_MAX)) {
+		return error(start, "Token Error: integer literal " + std::string(source + start, pos - start)
+			+ " out of range at position " + std::to_string(start));
+	}
+	value = negative ? static_cast<int>(-val) : static_cast<int>(val);
+	return TokenKind::Int;
+}
+
+void printTokens(const std::string &source) {
+	SymbolTable symbols;
+	Status status;
+	Lexer lex(source, symbols, status);
+	for (Token t = lex.next(); t.kind != TokenKind::End; t = lex.next()) {
+		if (t.kind == TokenKind::Error) {
+			std::cout << status.message << std::endl;
+			break;
+		}
+		std::cout << t.text.str() << std::endl;
+	}
+}
+
+// =========================================== parsing ================================================
+
+/*
+ * <expr> := <variable> # any non-empty alphabetic sequences except for boolean literals and keywords
+ *                      # a let binds it in <expr2> only, hiding any variable of the same name there;
+ *                      # a name that no let binds is a free variable, the same one wherever it is free
+ *         | <integer> # 0 | 1 | -1 | ...
+ *                     # - 1 is invalid. The digits must immediately follow the negative sign.
+ *         | <boolean> # true | false
+ *         | ( - <expr1> <expr2> )
+ *         | ( * <expr1> <expr2> )
+ *         | ( / <expr1> <expr2> )
+ *         | ( < <expr1> <expr2> )
+ *         | ( + <expr1> <expr2> )
+ *         | ( && <expr1> <expr2> )
+ *         | ( || <expr1> <expr2> )
+ *         | ( ! <expr> )
+ *         | ( <= <expr1> <expr2> )
+ *         | ( > <expr1> <expr2> )
+ *         | ( >= <expr1> <expr2> )
+ *         | ( == <expr1> <expr2> )
+ *         | ( != <expr1> <expr2> )
+ *         | ( if <expr1> then <expr2> else <expr3> )
+ *         | ( let <variable> = <expr1> in <expr2> )
+ */
+
+/*
+ * The parser is written once and instantiated with a builder that decides what parsed expressions become.
+ * A builder provides
+ *   Result                                     the value of a parsed (sub)expression
+ *   Result var(Span name, int symbol)          <variable>
+ *   Result binder(Span name, int symbol)       the <variable> of a let
+ *   Result integer(int val)                    <integer>
+ *   Result boolean(bool val)                   <boolean>
+ *   Result enter(NodeKind k)                   seen "( op" of a compound expression, before its subexpressions
+ *   Result operation(NodeKind k, Result self, Result e1, Result e2)    ( op <expr1> <expr2> ) for an operator k,
+ *                                                                      without e2 if it is unary
+ *   Result ifThenElse(Result self, Result e1, Result e2, Result e3)    ( if <expr1> then <expr2> else <expr3> )
+ *   Result let(Result self, Result v, Result e1, Result e2)            ( let <variable> = <expr1> in <expr2> )
+ * where self is what enter() returned for the same expression. A builder that rejects an expression records the
+ * error in the status that the parser was given, and the parser stops there.
+ */
+
+// the error for a compound expression of kind k without its closing parenthesis
+static std::string missingParenthesis(NodeKind k) {
+	switch (k) {
+	case NodeKind::If:
+		return "Syntax Error: missing ) in (if <expr1> then <expr2> else <expr3>)";
+	case NodeKind::Let:
+		return "Syntax Error: missing ) in (let <variable> = <expr1> in <expr2>)";
+	default:
+		return std::string("Syntax Error: missing ) in (") + rule(k).symbol
+			+ (rule(k).arity == 1 ? " <expr>)" : " <expr1> <expr2>)");
+	}
+}
+
+/*
+ * The parser for one <expr>, fed one token at a time. All of its state is in the object, so it can be resumed later.
+ * The open compound expressions are kept on an explicit stack rather than the native one, so the nesting depth is
+ * limited only by memory. Each frame holds the results of the subexpressions parsed so far; the <variable> of a let
+ * is its first one. Given a trail, the parser records the changes to its stack there, so that undo() can take it
+ * back to any mark() without a copy of the stack; a frame is recorded only the first time it changes after a mark.
+ * The parser also keeps the scopes: the <variable> of a let is declared as a new symbol, which the names in <expr2>
+ * (but not in <expr1>) are interned as.
+ */
+template<typename Builder> struct Parser {
+	typedef typename Builder::Result Result;
+
+	// what the next token has to be
+	enum class Want : unsigned char {
+		Expr, Operator, Binder, Equal, Then, Else, In, RParen, Done
+	};
+	struct Frame {
+		NodeKind kind;
+		int done; // the number of subexpressions parsed
+		Result self;
+		Result e[3];
+		int bound, hidden; // of a let: the symbol of its variable, and the one that it hides in <expr2>
+		unsigned recorded; // the last mark since which it is on the trail, or that it was pushed after
+	};
+	// a change to the stack: its size before, and the frame at index before (index -1 for a push)
+	struct Change {
+		std::size_t size;
+		int index;
+		Frame frame;
+	};
+
+	// consume the next token; false on an error, which is recorded in status
+	bool feed(Lexer &lex, const Token &t, Builder &b, Status &status) {
+		if (t.kind == TokenKind::Error) { // recorded by the lexer
+			return false;
+		}
+		switch (want) {
+		case Want::Expr: // the start of a subexpression: either a whole leaf, or "(" which opens a frame
+			switch (t.kind) {
+			case TokenKind::End:
+				return fail(lex, t, "Syntax Error: Expressions and subexpressions cannot be empty.", status);
+			case TokenKind::Name: // <variable>
+				return complete(b.var(t.text, t.value), b, status);
+			case TokenKind::Int: // <integer>
+				return complete(b.integer(t.value), b, status);
+			case TokenKind::Bool: // <boolean>
+				return complete(b.boolean(t.value), b, status);
+			case TokenKind::LParen: // left parenthesis (
+				want = Want::Operator;
+				return true;
+			default:
+				return fail(lex, t, "Syntax Error: Expressions and subexpressions cannot start with token "
+					+ t.text.str(), status);
+			}
+		case Want::Operator: {
+			Frame f;
+			f.done = 0;
+			switch (t.kind) {
+			case TokenKind::End:
+				return fail(lex, t, "Syntax Error: Expressions and subexpressions cannot be (.", status);
+			case TokenKind::If: // ( if <expr1> then <expr2> else <expr3> )
+				f.kind = NodeKind::If;
+				break;
+			case TokenKind::Let: // ( let <variable> = <expr1> in <expr2> )
+				f.kind = NodeKind::Let;
+				break;
+			default:
+				if (!isOperator(t.kind)) {
+					return fail(lex, t, "Syntax Error: Expressions and subexpressions cannot start with ( and "
+						+ t.text.str(), status);
+				}
+				f.kind = operatorOf(t.kind); // ( op <expr1> <expr2> )
+				f.e[1] = Result(); // for a unary one
+				break;
+			}
+			f.self = b.enter(f.kind);
+			push(f);
+			want = f.kind == NodeKind::Let ? Want::Binder : Want::Expr;
+			return true;
+		}
+		case Want::Binder: {
+			if (t.kind == TokenKind::End) {
+				return fail(lex, t, "Syntax Error: Expressions and subexpressions cannot be empty.", status);
+			}
+			if (t.kind != TokenKind::Name) {
+				return fail(lex, t, "Syntax Error: The token following 'let' must be a variable.", status);
+			}
+			Frame &f = top();
+			f.bound = lex.symbols.declare(t.value);
+			f.e[f.done++] = b.binder(t.text, f.bound);
+			want = Want::Equal;
+			return status.ok();
+		}
+		case Want::Equal:
+			return next(lex, t, TokenKind::Equal, "Syntax Error: missing = in (let <variable> = <expr1> in <expr2>)",
+				status);
+		case Want::Then:
+			return next(lex, t, TokenKind::Then,
+				"Syntax Error: missing 'then' in (if <expr1> then <expr2> else <expr3>)", status);
+		case Want::Else:
+			return next(lex, t, TokenKind::Else,
+				"Syntax Error: missing 'else' in (if <expr1> then <expr2> else <expr3>)", status);
+		case Want::In: {
+			if (!next(lex, t, TokenKind::In, "Syntax Error: missing 'in' in (let <variable> = <expr1> in <expr2>)",
+				status)) {
+				return false;
+			}
+			Frame &f = top();
+			f.hidden = lex.symbols.show(f.bound);
+			return true;
+		}
+		case Want::RParen: {
+			Frame f = stack.back();
+			if (t.kind != TokenKind::RParen) {
+				return fail(lex, t, missingParenthesis(f.kind), status);
+			}
+			pop();
+			Result cur;
+			if (f.kind == NodeKind::If) {
+				cur = b.ifThenElse(f.self, f.e[0], f.e[1], f.e[2]);
+			} else if (f.kind == NodeKind::Let) {
+				lex.symbols.hide(f.bound, f.hidden);
+				cur = b.let(f.self, f.e[0], f.e[1], f.e[2]);
+			} else {
+				cur = b.operation(f.kind, f.self, f.e[0], f.e[1]);
+			}
+			return status.ok() && complete(cur, b, status);
+		}
+		default: // Done
+			return true;
+		}
+	}
+
+	// record a syntax error at token t
+	bool fail(Lexer &lex, const Token &t, const std::string &message, Status &status) {
+		return status.fail(ErrorKind::Syntax, lex.position(t), message);
+	}
+	// a separator keyword, after which a subexpression follows
+	bool next(Lexer &lex, const Token &t, TokenKind k, const char *message, Status &status) {
+		if (t.kind != k) {
+			return fail(lex, t, message, status);
+		}
+		want = Want::Expr;
+		return true;
+	}
+	// a subexpression is complete: hand it to its parent, and wait for what follows it there
+	bool complete(Result cur, Builder &, Status &status) {
+		if (!status.ok()) {
+			return false;
+		}
+		if (stack.empty()) {
+			result = cur;
+			want = Want::Done;
+			return true;
+		}
+		Frame &f = top();
+		f.e[f.done++] = cur;
+		if (f.kind == NodeKind::If) {
+			want = f.done == 1 ? Want::Then : f.done == 2 ? Want::Else : Want::RParen;
+		} else if (f.kind == NodeKind::Let) {
+			want = f.done == 2 ? Want::In : Want::RParen;
+		} else {
+			want = f.done < rule(f.kind).arity ? Want::Expr : Want::RParen;
+		}
+		return true;
+	}
+
+	// the top frame, to be changed
+	Frame &top() {
+		record();
+		return stack.back();
+	}
+	void push(Frame f) {
+		if (trail) {
+			trail->push_back(Change{stack.size(), -1, Frame()});
+		}
+		f.recorded = marks;
+		stack.push_back(f);
+	}
+	void pop() {
+		record();
+		stack.pop_back();
+	}
+	// the top frame as it was at the last mark, unless it is on the trail since then
+	void record() {
+		if (trail && stack.back().recorded != marks) {
+			trail->push_back(Change{stack.size(), static_cast<int>(stack.size()) - 1, stack.back()});
+			stack.back().recorded = marks;
+		}
+	}
+	// a point to undo() back to, as the length of the trail
+	std::size_t mark() {
+		marks++;
+		return trail->size();
+	}
+	// undo the changes to the stack since the mark length, which is then the last one
+	void undo(std::size_t length) {
+		while (trail->size() > length) {
+			const Change &c = trail->back();
+			stack.resize(c.size);
+			if (c.index != -1) {
+				stack[c.index] = c.frame;
+			}
+			trail->pop_back();
+		}
+		marks++;
+	}
+
+	Want want = Want::Expr;
+	std::vector<Frame> stack;
+	Result result; // the whole expression, once want is Done
+	std::vector<Change> *trail = nullptr;
+	unsigned marks = 0;
+};
+
+// Parse one <expr>. The result is only meaningful if status is ok afterwards.
+template<typename Builder> typename Builder::Result parseExpr(Lexer &lex, Builder &b, Status &status) {
+	Parser<Builder> p;
+	while (p.want != Parser<Builder>::Want::Done) {
+		if (!p.feed(lex, lex.next(), b, status)) {
+			return typename Builder::Result();
+		}
+	}
+	if (!lex.finish()) {
+		return typename Builder::Result();
+	}
+	return p.result;
+}
+
+// the builder for the AST
+struct TreeBuilder {
+	typedef Node *Result;
+
+	TreeBuilder(Arena &arena0) : arena(arena0) {}
+	Node *var(Span name, int symbol) {
+		return arena.make<Var>(name, symbol);
+	}
+	Node *binder(Span name, int symbol) {
+		return arena.make<Var>(name, symbol);
+	}
+	Node *integer(int val) {
+		return arena.make<Int>(val);
+	}
+	Node *boolean(bool val) {
+		return arena.make<Bool>(val);
+	}
+	Node *enter(NodeKind) {
+		return nullptr;
+	}
+	Node *operation(NodeKind k, Node *, Node *n1, Node *n2) {
+		return arena.make<Operation>(k, n1, n2);
+	}
+	Node *ifThenElse(Node *, Node *n1, Node *n2, Node *n3) {
+		return arena.make<If>(n1, n2, n3);
+	}
+	Node *let(Node *, Node *n1, Node *n2, Node *n3) {
+		return arena.make<Let>(n1, n2, n3);
+	}
+
+	Arena &arena;
+};
+
+Node *parse(Lexer &lex, Arena &arena, Status &status) {
+	TreeBuilder b(arena);
+	Node *root = parseExpr(lex, b, status);
+	return status.ok() ? root : nullptr;
+}
+
+std::string astLiteral(Node *root) {
+	// the nodes still to print, in reverse, between the text that follows each of them (node nullptr)
+	struct Item {
+		Node *node;
+		const char *text;
+	};
+	std::string out;
+	std::vector<Item> stack(1, Item{root, nullptr});
+	while (!stack.empty()) {
+		Item cur = stack.back();
+		stack.pop_back();
+		if (!cur.node) {
+			out += cur.text;
+			continue;
+		}
+		switch (cur.node->kind) {
+		case NodeKind::Var:
+		case NodeKind::Int:
+		case NodeKind::Bool: // leaves
+			out += cur.node->getLiteral();
+			break;
+		case NodeKind::If:
+		case NodeKind::Let: {
+			auto r = static_cast<Ternary*>(cur.node);
+			out += r->kind == NodeKind::If ? "[If " : "[Let ";
+			stack.push_back(Item{nullptr, "]"});
+			stack.push_back(Item{r->n3, nullptr});
+			stack.push_back(Item{nullptr, " "});
+			stack.push_back(Item{r->n2, nullptr});
+			stack.push_back(Item{nullptr, " "});
+			stack.push_back(Item{r->n1, nullptr});
+			break;
+		}
+		default: { // operators
+			auto r = static_cast<Operation*>(cur.node);
+			out += '[';
+			out += rule(r->kind).name;
+			out += ' ';
+			stack.push_back(Item{nullptr, "]"});
+			if (r->n2) {
+				stack.push_back(Item{r->n2, nullptr});
+				stack.push_back(Item{nullptr, " "});
+			}
+			stack.push_back(Item{r->n1, nullptr});
+			break;
+		}
+		}
+	}
+	return out;
+}
+
+void printAST(Node *root) {
+	std::cout << astLiteral(root) << std::endl;
+}
+
+// =========================================== type inference and type check ==========================================
+
+std::string properTypeName(int t) {
+	return t == INT ? "INT" : "BOOL";
+}
+
+template<typename UF>
+static bool unifyIn(UF &uf, int x, int y, Status &status) {
+	if (y < 0 ? uf.assign(x, y) : uf.join(x, y)) {
+		return true;
+	}
+	int ty = y < 0 ? y : uf.type[uf.find(y)];
+	return status.fail(ErrorKind::Type, -1,
+		"Type Error: cannot unify " + properTypeName(uf.type[uf.find(x)]) + " and " + properTypeName(ty));
+}
+
+bool unify(UnionFind &uf, int x, int y, Status &status) {
+	return unifyIn(uf, x, y, status);
+}
+
+bool unify(UndoUnionFind &uf, int x, int y, Status &status) {
+	return unifyIn(uf, x, y, status);
+}
+
+bool unify(ConcurrentUnionFind &uf, int x, int y, Status &status) {
+	return unifyIn(uf, x, y, status);
+}
+
+// the constraints of the operator k on the type variables of its node and operands (e2 only if it is binary), in
+// the order [] = result, [<expr1>] = operand, [<expr2>] = operand, until one fails
+template<typename Constrain>
+static bool constrainOperator(NodeKind k, int self, int e1, int e2, Constrain constrain) {
+	const OperatorRule &r = rule(k);
+	return constrain(self, r.result) && constrain(e1, r.operand) && (r.arity == 1 || constrain(e2, r.operand));
+}
+
+// the symbol types, given the type variable of each symbol (or -1 for none)
+template<typename UF>
+static SymbolTypes solve(UF &uf, const std::vector<int> &variable_number, int symbols) {
+	SymbolTypes ret(symbols, NO_TYPE);
+	std::vector<int> generic(uf.n, -1); // by root
+	int generics = 0;
+	for (int i = 0; i < static_cast<int>(variable_number.size()); i++) {
+		if (variable_number[i] == -1) {
+			continue;
+		}
+		int r = uf.find(variable_number[i]);
+		if (uf.type[r] != 0) {
+			ret[i] = uf.type[r];
+		} else {
+			if (generic[r] == -1) {
+				generic[r] = generics++;
+			}
+			ret[i] = generic[r];
+		}
+	}
+	return ret;
+}
+
+void formatType(int t, std::string &out) {
+	if (t == INT) {
+		out += "INT";
+	} else if (t == BOOL) {
+		out += "BOOL";
+	} else {
+		out += "GENERICS-";
+		out += std::to_string(t);
+	}
+}
+
+SymbolTypes typecheck(Node *root, const SymbolTable &symbols, Status &status) {
+	// assign numbers to AST nodes
+	int counter = 0;
+	std::vector<int> variable_number(symbols.size(), -1);
+	auto assign_numbers = [&counter, &variable_number](Node *cur) -> bool {
+		if (cur->kind == NodeKind::Var) { // Different occurances of the same variable share the same number.
+			auto c = static_cast<Var*>(cur);
+			if (variable_number[c->symbol] == -1) {
+				variable_number[c->symbol] = counter++;
+			}
+			c->number = variable_number[c->symbol];
+		} else {
+			cur->number = counter++;
+		}
+		return true;
+	};
+	dfs(root, assign_numbers);
+
+	// generate and solve constraints
+	// Constraints have the form x = y, where x and y are type variables or INT or BOOL.
+	// Each one is unified as soon as it is generated, so the first type error ends the check.
+	/*
+	 * # Type Constraints ([] represents the whole expression)
+	 * <variable>                               :
+	 * <integer>                                : [] = INT
+	 * <boolean>                                : [] = BOOL
+	 * ( op <expr1> <expr2> )                   : [] = result, [<expr1>] = operand, [<expr2>] = operand
+	 *                                            with the result and operand types of op in operator_rules
+	 * ( if <expr1> then <expr2> else <expr3> ) : [] = [<expr2>], [<expr1>] = BOOL, [<expr2>] = [<expr3>]
+	 * ( let <variable> = <expr1> in <expr2> )  : [] = [<expr2>], [<variable>] = [<expr1>]
+	 */
+	UnionFind uf(counter);
+	auto constrain = [&uf, &status](int x, int y) -> bool {
+		return unify(uf, x, y, status);
+	};
+	auto generate_constraints = [&constrain](Node *cur) -> bool {
+		switch (cur->kind) {
+		case NodeKind::Var:
+			// <variable> :
+			return true;
+		case NodeKind::Int:
+			// <integer> : [] = INT
+			return constrain(cur->number, INT);
+		case NodeKind::Bool:
+			// <boolean> : [] = BOOL
+			return constrain(cur->number, BOOL);
+		case NodeKind::If: {
+			// ( if <expr1> then <expr2> else <expr3> ) : [] = [<expr2>], [<expr1>] = BOOL, [<expr2>] = [<expr3>]
+			auto c = static_cast<If*>(cur);
+			return constrain(c->number, c->n2->number) && constrain(c->n1->number, BOOL)
+				&& constrain(c->n2->number, c->n3->number);
+		}
+		case NodeKind::Let: {
+			// ( let <variable> = <expr1> in <expr2> ) : [] = [<expr2>], [<variable>] = [<expr1>]
+			auto c = static_cast<Let*>(cur);
+			return constrain(c->number, c->n3->number) && constrain(c->n1->number, c->n2->number);
+		}
+		default: {
+			// ( op <expr1> <expr2> ) : [] = result, [<expr1>] = operand, [<expr2>] = operand
+			auto c = static_cast<Operation*>(cur);
+			return constrainOperator(c->kind, c->number, c->n1->number, c->n2 ? c->n2->number : -1, constrain);
+		}
+		}
+	};
+	if (!dfs(root, generate_constraints)) {
+		return SymbolTypes();
+	}
+
+	return solve(uf, variable_number, symbols.size());
+}
+
+// ================================================= flat AST =========================================================
+
+FlatAst flatten(Node *root) {
+	FlatAst ast;
+	// the pending subtrees, each with the node that it is the second (child2) or third (child3) child of, if any
+	struct Pending {
+		Node *node;
+		int parent;
+		std::vector<int> FlatAst::*child;
+	};
+	std::vector<Pending> stack(1, Pending{root, -1, nullptr});
+	while (!stack.empty()) {
+		Pending p = stack.back();
+		stack.pop_back();
+		Node *cur = p.node;
+		int i;
+		switch (cur->kind) {
+		case NodeKind::Var:
+			i = ast.push(NodeKind::Var, static_cast<Var*>(cur)->symbol);
+			break;
+		case NodeKind::Int:
+			i = ast.push(NodeKind::Int, static_cast<Int*>(cur)->val);
+			break;
+		case NodeKind::Bool:
+			i = ast.push(NodeKind::Bool, static_cast<Bool*>(cur)->val);
+			break;
+		case NodeKind::If:
+		case NodeKind::Let: {
+			auto r = static_cast<Ternary*>(cur);
+			i = ast.push(cur->kind, 0);
+			stack.push_back(Pending{r->n3, i, &FlatAst::child3});
+			stack.push_back(Pending{r->n2, i, &FlatAst::child2});
+			stack.push_back(Pending{r->n1, i, nullptr});
+			break;
+		}
+		default: { // operators
+			auto r = static_cast<Operation*>(cur);
+			i = ast.push(cur->kind, 0);
+			if (r->n2) {
+				stack.push_back(Pending{r->n2, i, &FlatAst::child2});
+			}
+			stack.push_back(Pending{r->n1, i, nullptr});
+			break;
+		}
+		}
+		if (p.child) {
+			(ast.*p.child)[p.parent] = i;
+		}
+	}
+	return ast;
+}
+
+// the constraints of node i of a FlatAst or an AstImage (see typecheck(Node*) for the rules), where num(j) is the
+// type variable of node j
+template<typename Ast, typename Number, typename Constrain>
+static bool constrainNode(const Ast &ast, int i, Number num, Constrain constrain) {
+	switch (ast.kind[i]) {
+	case NodeKind::Var:
+		return true;
+	case NodeKind::Int:
+		return constrain(num(i), INT);
+	case NodeKind::Bool:
+		return constrain(num(i), BOOL);
+	case NodeKind::If:
+		return constrain(num(i), num(ast.child2[i])) && constrain(num(i + 1), BOOL)
+			&& constrain(num(ast.child2[i]), num(ast.child3[i]));
+	case NodeKind::Let:
+		return constrain(num(i), num(ast.child3[i])) && constrain(num(i + 1), num(ast.child2[i]));
+	default:
+		return constrainOperator(ast.kind[i], num(i), num(i + 1), ast.child2[i] != -1 ? num(ast.child2[i]) : -1,
+			constrain);
+	}
+}
+
+// typecheck() on a FlatAst or an AstImage, numbering the nodes into number
+template<typename Ast>
+static SymbolTypes typecheckFlat(const Ast &ast, int symbols, std::vector<int> &number, Status &status) {
+	int n = ast.size();
+
+	// assign numbers to AST nodes
+	int counter = 0;
+	number.resize(n);
+	std::vector<int> variable_number(symbols, -1);
+	for (int i = 0; i < n; i++) {
+		if (ast.kind[i] == NodeKind::Var) { // Different occurances of the same variable share the same number.
+			int &v = variable_number[ast.value[i]];
+			if (v == -1) {
+				v = counter++;
+			}
+			number[i] = v;
+		} else {
+			number[i] = counter++;
+		}
+	}
+
+	// generate and solve constraints
+	const int *num = number.data();
+	UnionFind uf(counter);
+	auto constrain = [&uf, &status](int x, int y) -> bool {
+		return unify(uf, x, y, status);
+	};
+	auto node = [num](int j) -> int {
+		return num[j];
+	};
+	for (int i = 0; i < n; i++) {
+		if (!constrainNode(ast, i, node, constrain)) {
+			return SymbolTypes();
+		}
+	}
+
+	return solve(uf, variable_number, symbols);
+}
+
+SymbolTypes typecheck(FlatAst &ast, const SymbolTable &symbols, Status &status) {
+	return typecheckFlat(ast, symbols.size(), ast.number, status);
+}
+
+/*
+ * One subtree of typecheckParallel(), checked alone: its nodes are numbered from 0 in pre-order as in typecheck(), and
+ * solved in a union-find of its own. What the rest of the tree sees of it is the class of its root and of each of
+ * its variables, which it reports as links: each of them is tied to the first one reported of the same class, and to
+ * the proper type of the class if it has one.
+ */
+struct SubtreeChecker {
+	struct Link {
+		int x, to, type; // to == x for the first of a class
+	};
+
+	// the global element of a node: its own index, or after the nodes the symbol of a variable
+	template<typename Ast>
+	static int element(const Ast &ast, int i) {
+		return ast.kind[i] == NodeKind::Var ? ast.size() + ast.value[i] : i;
+	}
+
+	// check the subtree [root, end), replacing links; false with a type error in status
+	template<typename Ast>
+	bool check(const Ast &ast, int root, int end, Status &status) {
+		links.clear();
+		number.resize(end - root);
+		int counter = 0;
+		for (int i = root; i < end; i++) {
+			if (ast.kind[i] == NodeKind::Var) {
+				int s = ast.value[i];
+				if (s >= static_cast<int>(variable_number.size())) {
+					variable_number.resize(s + 1, -1);
+				}
+				if (variable_number[s] == -1) {
+					variable_number[s] = counter++;
+					symbols.push_back(s);
+					occurs[s] = true;
+				}
+				number[i - root] = variable_number[s];
+			} else {
+				number[i - root] = counter++;
+			}
+		}
+		const int *num = number.data() - root;
+		UnionFind uf(counter);
+		auto constrain = [&uf, &status](int x, int y) -> bool {
+			return unify(uf, x, y, status);
+		};
+		auto node = [num](int j) -> int {
+			return num[j];
+		};
+		bool ok = true;
+		for (int i = root; i < end && ok; i++) {
+			ok = constrainNode(ast, i, node, constrain);
+		}
+
+		first.assign(counter, -1);
+		auto link = [&](int x, int local) -> void {
+			int r = uf.find(local);
+			if (first[r] == -1) {
+				first[r] = x;
+			}
+			links.push_back(Link{x, first[r], uf.type[r]});
+		};
+		link(element(ast, root), num[root]);
+		for (int s : symbols) {
+			link(ast.size() + s, variable_number[s]);
+			variable_number[s] = -1;
+		}
+		symbols.clear();
+		return ok;
+	}
+
+	std::vector<int> number; // of each node of the subtree
+	std::vector<int> variable_number; // by symbol, -1 outside the subtree being checked
+	std::vector<int> symbols; // that occur in it
+	std::vector<int> first; // by local root: the first element linked to it
+	std::vector<Link> links; // of the last subtree checked
+	std::vector<bool> occurs; // by symbol: in any subtree checked; sized by the caller
+};
+
+// typecheckParallel() on a FlatAst or an AstImage
+template<typename Ast>
+static SymbolTypes typecheckParallelIn(const Ast &ast, int symbols, Status &status, int jobs) {
+	int n = ast.size();
+	if (n == 0) {
+		return SymbolTypes(symbols, NO_TYPE);
+	}
+	// the end of the subtree of each node, whose last child is the last one to end
+	std::vector<int> end(n);
+	for (int i = n - 1; i >= 0; i--) {
+		int last = ast.child3[i] != -1 ? ast.child3[i] : ast.child2[i] != -1 ? ast.child2[i]
+			: isOperator(ast.kind[i]) ? i + 1 : -1; // a unary operator has only its first child
+		end[i] = last != -1 ? end[last] : i + 1;
+	}
+
+	// Split off the largest subtrees of at most target nodes; smaller ones stay with the nodes above them.
+	const int target = std::max(1 << 12, n / (8 * std::max(1, jobs))), smallest = 1 << 8;
+	std::vector<int> roots;
+	std::vector<int> stack(1, 0);
+	while (!stack.empty()) {
+		int i = stack.back();
+		stack.pop_back();
+		if (end[i] - i <= target) {
+			if (end[i] - i >= smallest) {
+				roots.push_back(i);
+			}
+			continue;
+		}
+		for (int c : {ast.child3[i], ast.child2[i], i + 1 < end[i] ? i + 1 : -1}) {
+			if (c != -1) {
+				stack.push_back(c);
+			}
+		}
+	}
+	std::sort(roots.begin(), roots.end());
+
+	// The nodes above the subtrees and the roots of the subtrees are numbered in pre-order, and then the symbols, for
+	// one union-find over them all.
+	int tasks = roots.size();
+	std::vector<int> slot(n);
+	int slots = 0;
+	for (int i = 0, task = 0; i < n; i++) {
+		if (task < tasks && roots[task] == i) {
+			slot[i] = slots++;
+			i = end[i] - 1;
+			task++;
+		} else if (ast.kind[i] != NodeKind::Var) {
+			slot[i] = slots++;
+		}
+	}
+	ConcurrentUnionFind uf(slots + symbols);
+	auto id = [&](int x) -> int { // of an element of SubtreeChecker
+		return x < n ? slot[x] : slots + x - n;
+	};
+	auto e = [&](int i) -> int {
+		return id(SubtreeChecker::element(ast, i));
+	};
+
+	// the subtrees in parallel, each thread unifying their links as it goes
+	int threads = std::max(1, std::min(jobs, tasks));
+	std::vector<SubtreeChecker> checkers(threads);
+	std::vector<Status> statuses(threads);
+	std::atomic<int> next(0);
+	auto work = [&](int self) -> void {
+		SubtreeChecker &checker = checkers[self];
+		Status &st = statuses[self];
+		checker.occurs.assign(symbols, false);
+		for (int t = next++; t < tasks; t = next++) {
+			bool ok = checker.check(ast, roots[t], end[roots[t]], st);
+			for (auto l = checker.links.begin(); ok && l != checker.links.end(); ++l) {
+				ok = unify(uf, id(l->x), id(l->to), st) && (l->type == 0 || unify(uf, id(l->x), l->type, st));
+			}
+			if (!ok) {
+				next = tasks; // stop early
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) {
+		pool.emplace_back(work, i);
+	}
+	work(0);
+	for (auto &t : pool) {
+		t.join();
+	}
+	std::vector<int> variable_number(symbols, -1);
+	for (int i = 0; i < threads; i++) {
+		if (!statuses[i].ok()) {
+			status = statuses[i];
+			return SymbolTypes();
+		}
+		for (int s = 0; s < symbols; s++) {
+			if (checkers[i].occurs[s]) {
+				variable_number[s] = slots + s;
+			}
+		}
+	}
+
+	// the nodes above the subtrees
+	auto constrain = [&uf, &status](int x, int y) -> bool {
+		return unify(uf, x, y, status);
+	};
+	for (int i = 0, task = 0; i < n; i++) {
+		if (task < tasks && roots[task] == i) {
+			i = end[i] - 1;
+			task++;
+			continue;
+		}
+		if (ast.kind[i] == NodeKind::Var) {
+			variable_number[ast.value[i]] = e(i);
+		}
+		if (!constrainNode(ast, i, e, constrain)) {
+			return SymbolTypes();
+		}
+	}
+	return solve(uf, variable_number, symbols);
+}
+
+SymbolTypes typecheckParallel(const FlatAst &ast, const SymbolTable &symbols, Status &status, int jobs) {
+	return typecheckParallelIn(ast, symbols.size(), status, jobs);
+}
+
+// ================================================ AST image =========================================================
+
+// the header of an AST image
+struct AstImageHeader {
+	char magic[4];
+	std::uint32_t version, nodes, symbols, name_bytes, flags;
+};
+
+static std::size_t padded(std::size_t size) {
+	return (size + 3) / 4 * 4;
+}
+
+template<typename T>
+static void appendArray(std::string &out, const T *data, std::size_t n) {
+	out.append(reinterpret_cast<const char*>(data), n * sizeof(T));
+	out.resize(padded(out.size()), '\0');
+}
+
+void writeAstImage(const FlatAst &ast, const SymbolTable &symbols, const SymbolTypes *types, std::string &out) {
+	std::size_t start = out.size();
+	std::vector<std::uint32_t> offsets, lengths;
+	std::size_t name_bytes = 0;
+	for (int s = 0; s < symbols.size(); s++) {
+		offsets.push_back(name_bytes);
+		lengths.push_back(symbols.name(s).size);
+		name_bytes += symbols.name(s).size;
+	}
+	AstImageHeader h = {{'T', 'I', 'F', 'A'}, AST_IMAGE_VERSION, static_cast<std::uint32_t>(ast.size()),
+		static_cast<std::uint32_t>(symbols.size()), static_cast<std::uint32_t>(name_bytes),
+		types != nullptr ? AST_IMAGE_TYPES : 0};
+	out.resize(padded(start)); // so that every part is aligned if out is
+	appendArray(out, &h, 1);
+	appendArray(out, ast.kind.data(), ast.size());
+	appendArray(out, ast.child2.data(), ast.size());
+	appendArray(out, ast.child3.data(), ast.size());
+	appendArray(out, ast.value.data(), ast.size());
+	appendArray(out, offsets.data(), offsets.size());
+	appendArray(out, lengths.data(), lengths.size());
+	if (types != nullptr) {
+		appendArray(out, types->data(), types->size());
+	}
+	for (int s = 0; s < symbols.size(); s++) {
+		out.append(symbols.name(s).data, symbols.name(s).size);
+	}
+}
+
+bool AstImage::load(const char *data, std::size_t size, std::string &error) {
+	*this = AstImage();
+	AstImageHeader h;
+	if (size < sizeof h) {
+		error = "not an AST image: too short";
+		return false;
+	}
+	std::memcpy(&h, data, sizeof h);
+	if (std::memcmp(h.magic, "TIFA", 4) != 0) {
+		error = "not an AST image";
+		return false;
+	}
+	if (h.version != AST_IMAGE_VERSION || (h.flags & ~AST_IMAGE_TYPES) != 0) {
+		error = "unsupported AST image version " + std::to_string(h.version);
+		return false;
+	}
+	bool has_types = h.flags & AST_IMAGE_TYPES;
+	unsigned long long n = h.nodes, m = h.symbols;
+	unsigned long long expected = sizeof h + padded(n) + 12 * n + (has_types ? 12 : 8) * m + h.name_bytes;
+	if (n == 0 || n > INT_MAX || m > INT_MAX || expected != size) {
+		error = "damaged AST image: wrong size";
+		return false;
+	}
+	const char *p = data + sizeof h;
+	kind = reinterpret_cast<const NodeKind*>(p);
+	p += padded(n);
+	child2 = reinterpret_cast<const int*>(p);
+	child3 = child2 + n;
+	value = child3 + n;
+	offsets = reinterpret_cast<const std::uint32_t*>(value + n);
+	lengths = offsets + m;
+	types = has_types ? reinterpret_cast<const int*>(lengths + m) : nullptr;
+	names = reinterpret_cast<const char*>(lengths + m + (has_types ? m : 0));
+	nodes = n;
+	symbols = m;
+
+	// Each node must be followed by its children's subtrees, one after the other, as flatten() lays them out.
+	std::vector<int> end(n);
+	for (int i = nodes - 1; i >= 0; i--) {
+		int children = 0; // that the kind has
+		switch (kind[i]) {
+		case NodeKind::Var:
+			if (value[i] < 0 || value[i] >= symbols) {
+				error = "damaged AST image: bad symbol at node " + std::to_string(i);
+				return false;
+			}
+			break;
+		case NodeKind::Int:
+			break;
+		case NodeKind::Bool:
+			if (value[i] != 0 && value[i] != 1) {
+				error = "damaged AST image: bad boolean at node " + std::to_string(i);
+				return false;
+			}
+			break;
+		case NodeKind::If:
+		case NodeKind::Let:
+			children = 3;
+			break;
+		default:
+			if (!isOperator(kind[i])) {
+				error = "damaged AST image: bad node kind at node " + std::to_string(i);
+				return false;
+			}
+			children = rule(kind[i]).arity;
+			break;
+		}
+		int next = i + 1; // where the next child must start
+		bool ok = (children >= 2) == (child2[i] != -1) && (children == 3) == (child3[i] != -1);
+		for (int c = 0; c < children && ok; c++) {
+			int child = c == 0 ? i + 1 : c == 1 ? child2[i] : child3[i];
+			ok = child == next && child < nodes;
+			if (ok) {
+				next = end[child];
+			}
+		}
+		if (!ok || (kind[i] == NodeKind::Let && kind[i + 1] != NodeKind::Var)) {
+			error = "damaged AST image: bad children at node " + std::to_string(i);
+			return false;
+		}
+		end[i] = next;
+	}
+	if (end[0] != nodes) {
+		error = "damaged AST image: nodes outside the tree";
+		return false;
+	}
+	for (int s = 0; s < symbols; s++) {
+		if (offsets[s] > h.name_bytes || lengths[s] > h.name_bytes - offsets[s] ||
+			(types != nullptr && types[s] < NO_TYPE)) {
+			error = "damaged AST image: bad symbol " + std::to_string(s);
+			return false;
+		}
+	}
+	return true;
+}
+
+void AstImage::symbolTable(SymbolTable &out) const {
+	// The first symbol of each name is interned; the later ones are the variables of lets, declared from it.
+	out.clear();
+	for (int s = 0; s < symbols; s++) {
+		int first = out.find(name(s));
+		if (first == -1) {
+			out.intern(name(s));
+		} else {
+			out.declare(first);
+		}
+	}
+}
+
+SymbolTypes typecheck(const AstImage &ast, Status &status) {
+	std::vector<int> number;
+	return typecheckFlat(ast, ast.symbols, number, status);
+}
+
+SymbolTypes typecheckParallel(const AstImage &ast, Status &status, int jobs) {
+	return typecheckParallelIn(ast, ast.symbols, status, jobs);
+}
+
+// ============================================ fused type check ======================================================
+
+/*
+ * typecheck() fused into the parser, so that checking finishes when parsing does and no AST is built.
+ * The type variables are numbered in the same pre-order as typecheck(), and the constraints of each expression are
+ * unified as soon as it has been parsed. The result of a parsed expression is its type variable.
+ * Knowing the lexer, it can place its type errors: at the closing parenthesis of the expression whose constraints
+ * failed, which is the last token read.
+ * The incremental checker uses it with an UndoUnionFind.
+ */
+template<typename UF>
+struct CheckBuilder {
+	typedef int Result;
+
+	CheckBuilder(Lexer &lex0, Status &status0) : lex(&lex0), status(&status0), uf(0) {}
+	int fresh() {
+		return uf.add();
+	}
+	void unify(int x, int y) {
+		if (status->ok() && !unifyIn(uf, x, y, *status)) {
+			status->position = lex->pos - 1;
+		}
+	}
+
+	int var(Span, int symbol) { // Different occurances of the same variable share the same number.
+		if (symbol >= static_cast<int>(variable_number.size())) {
+			variable_number.resize(symbol + 1, -1);
+		}
+		if (variable_number[symbol] == -1) {
+			variable_number[symbol] = fresh();
+		}
+		return variable_number[symbol];
+	}
+	int binder(Span name, int symbol) {
+		return var(name, symbol);
+	}
+	int integer(int) {
+		int self = fresh();
+		unify(self, INT);
+		return self;
+	}
+	int boolean(bool) {
+		int self = fresh();
+		unify(self, BOOL);
+		return self;
+	}
+	int enter(NodeKind) {
+		return fresh();
+	}
+	int operation(NodeKind k, int self, int e1, int e2) {
+		constrainOperator(k, self, e1, e2, [this](int x, int y) -> bool {
+			unify(x, y);
+			return true;
+		});
+		return self;
+	}
+	int ifThenElse(int self, int e1, int e2, int e3) {
+		unify(self, e2);
+		unify(e1, BOOL);
+		unify(e2, e3);
+		return self;
+	}
+	int let(int self, int v, int e1, int e2) {
+		unify(self, e2);
+		unify(v, e1);
+		return self;
+	}
+
+	// the symbol types, as returned by typecheck()
+	SymbolTypes types(const SymbolTable &symbols) {
+		return solve(uf, variable_number, symbols.size());
+	}
+
+	Lexer *lex;
+	Status *status;
+	std::vector<int> variable_number; // by symbol: its type variable, or -1
+	UF uf;
+};
+
+SymbolTypes parseAndTypecheck(Lexer &lex, Status &status) {
+	CheckBuilder<UnionFind> b(lex, status);
+	parseExpr(lex, b, status);
+	return status.ok() ? b.types(lex.symbols) : SymbolTypes();
+}
+
+// =============================================== front end ==========================================================
+
+SymbolTypes check(const char *source, std::size_t size, SymbolTable &symbols, Status &status) {
+	symbols.clear();
+	status = Status();
+	Lexer lex(source, size, symbols, status);
+	return parseAndTypecheck(lex, status);
+}
+
+SymbolTypes check(const std::string &source, SymbolTable &symbols, Status &status) {
+	return check(source.data(), source.size(), symbols, status);
+}
+
+int typeOf(const SymbolTypes &types, const SymbolTable &symbols, const std::string &name) {
+	Span n{name.data(), name.size()};
+	for (int s = 0; s < static_cast<int>(types.size()) && s < symbols.size(); s++) {
+		if (types[s] != NO_TYPE && symbols.name(s) == n) {
+			return types[s];
+		}
+	}
+	return NO_TYPE;
+}
+
+// append "name :: TYPE" to out
+static void formatTyping(Span name, int t, std::string &out) {
+	out.append(name.data, name.size);
+	out += " :: ";
+	formatType(t, out);
+	out += '\n';
+}
+
+// formatTypes() with the names of a SymbolTable or an AstImage
+template<typename Names>
+static void formatTypesIn(const SymbolTypes &types, const Names &symbols, int count, std::string &out) {
+	std::vector<int> order;
+	for (int i = 0; i < count; i++) {
+		if (types[i] != NO_TYPE) {
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(), [&symbols](int x, int y) -> bool { // the variables of a name in order
+		return symbols.name(x) < symbols.name(y) || (symbols.name(x) == symbols.name(y) && x < y);
+	});
+	for (int i : order) {
+		formatTyping(symbols.name(i), types[i], out);
+	}
+}
+
+void formatTypes(const SymbolTypes &types, const SymbolTable &symbols, std::string &out) {
+	formatTypesIn(types, symbols, symbols.size(), out);
+}
+
+void formatTypes(const SymbolTypes &types, const AstImage &image, std::string &out) {
+	formatTypesIn(types, image, image.symbols, out);
+}
+
+bool processLine(const std::string &line, std::string &out, SymbolTable &symbols, Status &status) {
+	auto types = check(line, symbols, status);
+	if (!status.ok()) {
+		return false;
+	}
+	formatTypes(types, symbols, out);
+	return true;
+}
+
+// ================================================ stats =============================================================
+
+// the hooks of the union-find of an instrumented check
+struct CountingHooks {
+	void onConstraint() {
+		constraints++;
+	}
+	void onFindStep() {
+		find_steps++;
+	}
+	void onCompress() {
+		compress_writes++;
+	}
+
+	long long constraints = 0, find_steps = 0, compress_writes = 0;
+};
+
+// CheckBuilder, also counting the nodes that the parser hands it
+struct CountingCheckBuilder : CheckBuilder<BasicUnionFind<CountingHooks>> {
+	typedef CheckBuilder<BasicUnionFind<CountingHooks>> Base;
+
+	CountingCheckBuilder(Lexer &lex0, Status &status0) : Base(lex0, status0) {}
+	int var(Span name, int symbol) {
+		nodes++;
+		return Base::var(name, symbol);
+	}
+	int binder(Span name, int symbol) {
+		nodes++;
+		return Base::binder(name, symbol);
+	}
+	int integer(int val) {
+		nodes++;
+		return Base::integer(val);
+	}
+	int boolean(bool val) {
+		nodes++;
+		return Base::boolean(val);
+	}
+	int enter(NodeKind k) {
+		nodes++;
+		return Base::enter(k);
+	}
+
+	long long nodes = 0;
+};
+
+static double seconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SymbolTypes check(const char *source, std::size_t size, SymbolTable &symbols, Status &status, Stats &stats) {
+	double t0 = seconds();
+	SymbolTable scratch;
+	Status scratch_status;
+	Lexer tokens(source, size, scratch, scratch_status);
+	for (Token t = tokens.next(); t.kind != TokenKind::End && t.kind != TokenKind::Error; t = tokens.next()) {
+	}
+	double t1 = seconds();
+
+	symbols.clear();
+	status = Status();
+	Lexer lex(source, size, symbols, status);
+	CountingCheckBuilder b(lex, status);
+	Parser<CountingCheckBuilder> p;
+	long long token_count = 0;
+	while (p.want != Parser<CountingCheckBuilder>::Want::Done) {
+		token_count++;
+		if (!p.feed(lex, lex.next(), b, status)) {
+			break;
+		}
+	}
+	if (status.ok()) {
+		lex.finish();
+	}
+	double t2 = seconds();
+	SymbolTypes types = status.ok() ? b.types(symbols) : SymbolTypes();
+	double t3 = seconds();
+
+	long long bytes = p.stack.capacity() * sizeof(p.stack[0]) + 3 * b.uf.prev.capacity() * sizeof(int) +
+		b.variable_number.capacity() * sizeof(int) +
+		symbols.text.capacity() + 3 * symbols.offsets.capacity() * sizeof(std::size_t) +
+		symbols.table.capacity() * sizeof(int);
+	stats.expressions++;
+	stats.bytes += size;
+	stats.tokens += token_count;
+	stats.nodes += b.nodes;
+	stats.constraints += b.uf.constraints;
+	stats.type_variables += b.uf.n;
+	stats.find_steps += b.uf.find_steps;
+	stats.compress_writes += b.uf.compress_writes;
+	stats.peak_bytes = std::max(stats.peak_bytes, bytes);
+	stats.tokenize_seconds += t1 - t0;
+	stats.check_seconds += t2 - t1;
+	stats.solve_seconds += t3 - t2;
+	return types;
+}
+
+bool processLine(const std::string &line, std::string &out, SymbolTable &symbols, Status &status, Stats &stats) {
+	auto types = check(line.data(), line.size(), symbols, status, stats);
+	if (!status.ok()) {
+		return false;
+	}
+	double t0 = seconds();
+	formatTypes(types, symbols, out);
+	stats.format_seconds += seconds() - t0;
+	return true;
+}
+
+void Stats::add(const Stats &other) {
+	expressions += other.expressions;
+	bytes += other.bytes;
+	tokens += other.tokens;
+	nodes += other.nodes;
+	constraints += other.constraints;
+	type_variables += other.type_variables;
+	find_steps += other.find_steps;
+	compress_writes += other.compress_writes;
+	peak_bytes = std::max(peak_bytes, other.peak_bytes);
+	tokenize_seconds += other.tokenize_seconds;
+	check_seconds += other.check_seconds;
+	solve_seconds += other.solve_seconds;
+	format_seconds += other.format_seconds;
+}
+
+void Stats::format(std::string &out) const {
+	char line[512];
+	std::snprintf(line, sizeof line, "stats: %lld expressions, %lld bytes, %lld tokens, %lld nodes, %lld constraints, "
+		"%lld type variables, %lld find steps, %lld compress writes, %lld peak bytes; "
+		"tokenize %.1f us, check %.1f us, solve %.1f us, format %.1f us\n", expressions, bytes, tokens, nodes,
+		constraints, type_variables, find_steps, compress_writes, peak_bytes, tokenize_seconds * 1e6,
+		check_seconds * 1e6, solve_seconds * 1e6, format_seconds * 1e6);
+	out += line;
+}
+
+// ============================================== incremental =========================================================
+
+// the state of an incremental check before one of its tokens; the rest of it is on the trails of the builder and the
+// parser
+struct Checkpoint {
+	std::size_t token; // the number of tokens fed before it
+	int symbols;
+	std::size_t scopes;
+	UndoUnionFind::Mark uf;
+	std::size_t frames; // the length of the parser's trail
+	Parser<CheckBuilder<UndoUnionFind>>::Want want;
+};
+
+/*
+ * The region of the last edit: a subexpression of a checked expression (the base) whose constraints were unified after
+ * those of the rest of it, so that an edit inside it can roll back just its own and unify those of its new text. The
+ * new text is parsed on its own, with a symbol table of its own that is mapped onto the base's: a name that is not
+ * bound inside the region is what it was at the start of the region in the base, and the symbols that the region
+ * makes (its lets, and the names first seen in it) must be the same ones in the same order, so that every symbol keeps
+ * its number. An edit that breaks any of this, or that has an error, is left to the checkpoints, which number the
+ * symbols and place the errors as check() does.
+ */
+struct Region {
+	// A node of the base, in pre-order, with its span in the base and the symbols made before it; only rebuild() makes
+	// them. The subexpressions of a node i are i + 1, the last of that, and so on.
+	struct Record {
+		NodeKind kind;
+		bool binder; // the <variable> of a let
+		int last; // one past its last descendant
+		int parent;
+		int symbols;
+		int symbol; // of a variable
+		std::size_t begin, end;
+	};
+
+	// the builder of rebuild(), which only records the nodes
+	struct RecordBuilder {
+		typedef int Result;
+
+		int leaf(NodeKind k, bool binder, int symbol) {
+			records.push_back(Record{k, binder, static_cast<int>(records.size()) + 1, -1, symbols_before, symbol,
+				token_begin, token_end});
+			return records.size() - 1;
+		}
+		int var(Span, int symbol) {
+			return leaf(NodeKind::Var, false, symbol);
+		}
+		int binder(Span, int symbol) {
+			return leaf(NodeKind::Var, true, symbol);
+		}
+		int integer(int) {
+			return leaf(NodeKind::Int, false, -1);
+		}
+		int boolean(bool) {
+			return leaf(NodeKind::Bool, false, -1);
+		}
+		int enter(NodeKind k) {
+			records.push_back(Record{k, false, 0, -1, paren_symbols, -1, paren_begin, 0});
+			return records.size() - 1;
+		}
+		int complete(int self, int e1, int e2, int e3) {
+			Record &r = records[self];
+			r.end = token_end;
+			r.last = records.size();
+			for (int c : {e1, e2, e3}) {
+				if (c != -1) {
+					records[c].parent = self;
+				}
+			}
+			return self;
+		}
+		int operation(NodeKind, int self, int e1, int e2) {
+			return complete(self, e1, rule(records[self].kind).arity == 1 ? -1 : e2, -1);
+		}
+		int ifThenElse(int self, int e1, int e2, int e3) {
+			return complete(self, e1, e2, e3);
+		}
+		int let(int self, int v, int e1, int e2) {
+			return complete(self, v, e1, e2);
+		}
+
+		std::vector<Record> records;
+		std::size_t token_begin = 0, token_end = 0, paren_begin = 0; // of the token fed, and of the last (
+		int symbols_before = 0, paren_symbols = 0; // the symbols before the token fed, and before the last (
+	};
+
+	// the builder of an edited region, onto the symbols and the union-find of the base
+	struct RegionBuilder {
+		typedef int Result;
+
+		int var(Span name, int local) {
+			int s = region.local_symbol[local];
+			region.count(s);
+			return region.b.var(name, s);
+		}
+		int binder(Span name, int local) {
+			int s = region.made(name, true);
+			if (s == -1) {
+				region.b.status->fail(ErrorKind::Syntax, 0, "");
+				return 0;
+			}
+			region.local_symbol.resize(local + 1, -1);
+			region.local_symbol[local] = s;
+			region.count(s);
+			return region.b.binder(name, s);
+		}
+		int integer(int val) {
+			return region.b.integer(val);
+		}
+		int boolean(bool val) {
+			return region.b.boolean(val);
+		}
+		int enter(NodeKind k) {
+			return region.b.enter(k);
+		}
+		int operation(NodeKind k, int self, int e1, int e2) {
+			return region.b.operation(k, self, e1, e2);
+		}
+		int ifThenElse(int self, int e1, int e2, int e3) {
+			return region.b.ifThenElse(self, e1, e2, e3);
+		}
+		int let(int self, int v, int e1, int e2) {
+			return region.b.let(self, v, e1, e2);
+		}
+
+		Region &region;
+	};
+
+	Region() : lex(text, symbols, status), b(lex, status) {}
+
+	// whether the bytes around [begin, end) of source separate its tokens from those outside
+	static bool delimited(const std::string &source, std::size_t begin, std::size_t end) {
+		auto delimiter = [](char ch) -> bool {
+			return iss(ch) || ch == '(' || ch == ')';
+		};
+		return (begin == 0 || delimiter(source[begin - 1])) && (end == source.size() || delimiter(source[end]));
+	}
+
+	// the next symbol that the region makes, if it is a let's (declared) or a name's of this name; else -1
+	int made(Span name, bool declared) {
+		if (next_symbol == symbols_after || this->declared[next_symbol] != declared
+			|| !(symbols.name(next_symbol) == name)) {
+			return -1;
+		}
+		return next_symbol++;
+	}
+	// an occurrence of symbol s in the region
+	void count(int s) {
+		if (inside[s]++ == 0) {
+			touched.push_back(s);
+		}
+	}
+
+	/*
+	 * Check source as an edit of the base inside the region; false, with nothing changed but the union-find, if it is
+	 * not one or if it has an error. Otherwise it becomes the base, with the new text of the region as the region.
+	 */
+	bool check(const std::string &source, SymbolTypes &types, long long &region_tokens) {
+		if (!valid) {
+			return false;
+		}
+		std::size_t common = std::min(text.size(), source.size()), prefix = 0, suffix = 0;
+		while (prefix < common && text[prefix] == source[prefix]) {
+			prefix++;
+		}
+		while (suffix < common - prefix && text[text.size() - 1 - suffix] == source[source.size() - 1 - suffix]) {
+			suffix++;
+		}
+		bool same = prefix == text.size() && text.size() == source.size();
+		if (!same && (prefix < begin || text.size() - suffix > end)) {
+			return false;
+		}
+		std::size_t new_end = end + source.size() - text.size();
+
+		b.uf.rollback(mark);
+		for (int s : touched) {
+			inside[s] = 0;
+		}
+		touched.clear();
+		local_symbol.clear();
+		next_symbol = symbols_before;
+		SymbolTable local;
+		Status st;
+		Lexer region_lex(source.data(), new_end, local, st);
+		region_lex.pos = begin;
+		b.lex = &region_lex;
+		b.status = &st;
+		RegionBuilder rb{*this};
+		Parser<RegionBuilder> parser;
+		std::size_t first = std::string::npos;
+		long long tokens = 0;
+		while (st.ok() && parser.want != Parser<RegionBuilder>::Want::Done) {
+			int before = local.size();
+			Token t = region_lex.next();
+			if (first == std::string::npos) {
+				first = region_lex.position(t);
+			}
+			for (int l = before; l < local.size(); l++) { // what the name was at the start of the region
+				int e = environment.find(local.name(l)), s = symbols.find(local.name(l));
+				s = e != -1 ? environment_symbol[e] : s != -1 && s < symbols_before ? s : made(local.name(l), false);
+				if (s == -1) {
+					st.fail(ErrorKind::Syntax, 0, "");
+				}
+				local_symbol.push_back(s);
+			}
+			tokens++;
+			if (st.ok()) {
+				parser.feed(region_lex, t, rb, st);
+			}
+		}
+		std::size_t last = region_lex.pos;
+		if (st.ok() && (region_lex.next().kind != TokenKind::End || next_symbol != symbols_after)) {
+			st.fail(ErrorKind::Syntax, 0, "");
+		}
+		if (st.ok()) {
+			b.unify(hole, parser.result);
+		}
+		b.lex = &lex;
+		b.status = &status;
+		if (!st.ok()) {
+			return false;
+		}
+		if (!same) {
+			text = source;
+		}
+		begin = first;
+		end = last;
+		region_tokens = tokens;
+
+		// the symbol types, as solve() finds them, of the symbols that occur in the new text
+		types.assign(symbols.size(), NO_TYPE);
+		generic.resize(b.uf.n, -1);
+		std::vector<int> roots;
+		for (int s = 0; s < symbols.size(); s++) {
+			if (outside[s] + inside[s] == 0) {
+				continue;
+			}
+			int r = b.uf.find(b.variable_number[s]);
+			if (b.uf.type[r] != 0) {
+				types[s] = b.uf.type[r];
+			} else {
+				if (generic[r] == -1) {
+					generic[r] = roots.size();
+					roots.push_back(r);
+				}
+				types[s] = generic[r];
+			}
+		}
+		for (int r : roots) {
+			generic[r] = -1;
+		}
+		return true;
+	}
+
+	/*
+	 * Make source, which check() found well-typed, the base, with the region around [at, to): the largest
+	 * subexpression of at most max_bytes around it, or else the smallest one; none if that is all of source.
+	 */
+	void rebuild(const std::string &source, std::size_t at, std::size_t to) {
+		valid = false;
+		text = source;
+		symbols.clear();
+		status = Status();
+		Lexer record_lex(text, symbols, status);
+		RecordBuilder rb;
+		Parser<RecordBuilder> parser;
+		long long tokens = 0;
+		while (parser.want != Parser<RecordBuilder>::Want::Done) {
+			int before = symbols.size();
+			Token t = record_lex.next();
+			rb.token_begin = record_lex.position(t);
+			rb.token_end = rb.token_begin + t.text.size;
+			rb.symbols_before = before;
+			if (t.kind == TokenKind::LParen) {
+				rb.paren_begin = rb.token_begin;
+				rb.paren_symbols = before;
+			}
+			tokens++;
+			if (!parser.feed(record_lex, t, rb, status)) {
+				return;
+			}
+		}
+		const std::vector<Record> &records = rb.records;
+
+		// The deepest node around the edit, then the largest subexpression around that of at most max_bytes, which
+		// has to be delimited.
+		int r = 0;
+		for (int i = 0; i < static_cast<int>(records.size()); i++) {
+			if (records[i].begin <= at && to <= records[i].end) {
+				r = i;
+			}
+		}
+		while (records[r].parent != -1 && (records[r].binder || !delimited(text, records[r].begin, records[r].end)
+			|| records[records[r].parent].end - records[records[r].parent].begin <= max_bytes)) {
+			r = records[r].parent;
+		}
+		if (records[r].parent == -1) { // which would keep nothing
+			return;
+		}
+		begin = records[r].begin;
+		end = records[r].end;
+		symbols_before = records[r].symbols;
+		symbols_after = records[r].last < static_cast<int>(records.size()) ? records[records[r].last].symbols
+			: symbols.size();
+
+		// What the names are at the start of the region: the symbol interned for it so far, unless a let around the
+		// region binds it.
+		declared.assign(symbols.size(), false);
+		for (const Record &c : records) {
+			if (c.binder) {
+				declared[c.symbol] = true;
+			}
+		}
+		std::vector<int> lets;
+		for (int q = records[r].parent, c = r; q != -1; c = q, q = records[q].parent) {
+			if (records[q].kind == NodeKind::Let && records[records[q + 1].last].last == c) {
+				lets.push_back(records[q + 1].symbol);
+			}
+		}
+		environment.clear();
+		environment_symbol.clear();
+		for (auto l = lets.rbegin(); l != lets.rend(); ++l) {
+			int e = environment.intern(symbols.name(*l));
+			environment_symbol.resize(environment.size(), -1);
+			environment_symbol[e] = *l;
+		}
+
+		// the constraints outside the region, with the region as one type variable
+		b = CheckBuilder<UndoUnionFind>(lex, status);
+		outside.assign(symbols.size(), 0);
+		inside.assign(symbols.size(), 0);
+		touched.clear();
+		for (int s = 0; s < symbols.size(); s++) {
+			b.var(Span(), s);
+		}
+		std::vector<int> number(records.size(), -1);
+		for (int i = 0; i < static_cast<int>(records.size()); i++) {
+			if (i == r) {
+				number[i] = hole = b.fresh();
+				i = records[r].last - 1;
+			} else if (records[i].kind == NodeKind::Var) {
+				number[i] = b.variable_number[records[i].symbol];
+				outside[records[i].symbol]++;
+			} else {
+				number[i] = b.fresh();
+			}
+		}
+		for (int i = 0; i < static_cast<int>(records.size()); i++) {
+			const Record &c = records[i];
+			if (i == r) {
+				i = c.last - 1;
+				continue;
+			}
+			int e[3] = {-1, -1, -1}; // its subexpressions
+			for (int k = 0, j = i + 1; k < 3 && j < c.last; k++, j = records[j].last) {
+				e[k] = j;
+			}
+			switch (c.kind) {
+			case NodeKind::Var:
+				break;
+			case NodeKind::Int:
+				b.unify(number[i], INT);
+				break;
+			case NodeKind::Bool:
+				b.unify(number[i], BOOL);
+				break;
+			case NodeKind::If:
+				b.ifThenElse(number[i], number[e[0]], number[e[1]], number[e[2]]);
+				break;
+			case NodeKind::Let:
+				b.let(number[i], number[e[0]], number[e[1]], number[e[2]]);
+				break;
+			default:
+				b.operation(c.kind, number[i], number[e[0]], e[1] != -1 ? number[e[1]] : -1);
+				break;
+			}
+		}
+		b.uf.trail.clear(); // These are never undone.
+		mark = b.uf.checkpoint();
+		valid = true;
+		SymbolTypes types;
+		long long region_tokens = 0;
+		valid = check(text, types, region_tokens);
+		outside_tokens = tokens - region_tokens;
+	}
+
+	const std::size_t max_bytes = 1 << 12;
+	bool valid = false;
+	std::string text; // the base
+	SymbolTable symbols; // of the base, which an edit inside the region keeps
+	Status status; // only used outside check()
+	Lexer lex;
+	CheckBuilder<UndoUnionFind> b;
+	UndoUnionFind::Mark mark; // before the constraints of the region
+	int hole; // the type variable of the region in the constraints outside it
+	std::size_t begin = 0, end = 0; // the region, in the base
+	int symbols_before = 0, symbols_after = 0; // the symbols that the region makes
+	long long outside_tokens = 0;
+	SymbolTable environment; // the names bound by the lets around the region
+	std::vector<int> environment_symbol; // by name: the symbol of the innermost such let
+	std::vector<bool> declared; // by symbol: made by a let
+	std::vector<int> outside, inside; // by symbol: its occurrences outside the region and in its new text
+	std::vector<int> touched; // the symbols that occur in the new text of the region
+	std::vector<int> local_symbol; // by symbol of the new text of the region: its symbol in the base
+	int next_symbol = 0; // the next one that the region makes
+	std::vector<int> generic; // by root: scratch for check()
+};
+
+struct IncrementalChecker::State {
+	State() : lex(source, symbols, status), builder(lex, status) {
+		parser.trail = &frames;
+	}
+
+	// save the state before token i
+	void save(std::size_t i) {
+		checkpoints.push_back(Checkpoint{i, symbols.size(), symbols.scopes.size(), builder.uf.checkpoint(),
+			parser.mark(), parser.want});
+		if (checkpoints.size() > max_checkpoints) { // Keep every other one, so they stay evenly spread.
+			for (std::size_t j = 1; 2 * j < checkpoints.size(); j++) {
+				checkpoints[j] = checkpoints[2 * j];
+			}
+			checkpoints.erase(checkpoints.begin() + (checkpoints.size() + 1) / 2, checkpoints.end());
+			interval *= 2;
+		}
+	}
+	// go back to the last checkpoint before token i, returning its token
+	std::size_t restore(std::size_t i) {
+		while (checkpoints.back().token > i) {
+			checkpoints.pop_back();
+		}
+		Checkpoint &c = checkpoints.back();
+		symbols.unscope(c.scopes);
+		symbols.truncate(c.symbols);
+		parser.undo(c.frames);
+		parser.want = c.want;
+		builder.uf.rollback(c.uf);
+		// The type variables made since the checkpoint are the ones numbered from uf.n on.
+		builder.variable_number.resize(std::min<std::size_t>(builder.variable_number.size(), c.symbols));
+		for (int &v : builder.variable_number) {
+			if (v >= builder.uf.n) {
+				v = -1;
+			}
+		}
+		return c.token;
+	}
+
+	const std::size_t max_checkpoints = 32;
+	const long long max_rechecked = 1 << 10; // tokens re-checked from a checkpoint, above which the region moves
+	std::string source;
+	std::vector<std::pair<std::size_t, std::size_t>> tokens; // the offset and size of the tokens fed so far, in source
+	SymbolTable symbols;
+	Status status; // only used before the first check
+	Lexer lex;
+	CheckBuilder<UndoUnionFind> builder;
+	Parser<CheckBuilder<UndoUnionFind>> parser;
+	std::vector<Parser<CheckBuilder<UndoUnionFind>>::Change> frames; // the trail of the parser
+	std::vector<Checkpoint> checkpoints; // by token, always starting with the one before token 0
+	std::size_t interval = 64; // the number of tokens between checkpoints
+	Region region;
+	long long owed = 0; // the tokens re-checked since the region was last made
+	const SymbolTable *last = &symbols; // the symbols of the last expression checked
+};
+
+IncrementalChecker::IncrementalChecker() : state(new State) {
+	state->save(0);
+}
+
+IncrementalChecker::~IncrementalChecker() {}
+
+const SymbolTable &IncrementalChecker::symbols() const {
+	return *state->last;
+}
+
+SymbolTypes IncrementalChecker::check(const std::string &source, Status &status) {
+	State &st = *state;
+	status = Status();
+	SymbolTypes types;
+	long long region_tokens = 0;
+	if (st.region.check(source, types, region_tokens)) {
+		reused += st.region.outside_tokens;
+		rechecked += region_tokens;
+		st.last = &st.region.symbols;
+		return types;
+	}
+	st.last = &st.symbols;
+
+	// The tokens that end before the first changed byte, and before the byte after them that the lexer looked at,
+	// are the same tokens at the same positions.
+	std::size_t diff = 0, common = std::min(st.source.size(), source.size());
+	while (diff < common && st.source[diff] == source[diff]) {
+		diff++;
+	}
+	std::size_t suffix = 0;
+	while (suffix < common - diff && st.source[st.source.size() - 1 - suffix] == source[source.size() - 1 - suffix]) {
+		suffix++;
+	}
+	st.source = source;
+	std::size_t same = std::lower_bound(st.tokens.begin(), st.tokens.end(), diff,
+		[](const std::pair<std::size_t, std::size_t> &t, std::size_t d) {
+			return t.first + t.second < d;
+		}) - st.tokens.begin();
+
+	std::size_t i = st.restore(same);
+	reused += i;
+	st.tokens.resize(i);
+	Lexer lex(st.source, st.symbols, status);
+	lex.pos = i == 0 ? 0 : st.tokens[i - 1].first + st.tokens[i - 1].second;
+	st.builder.lex = &lex;
+	st.builder.status = &status;
+	long long redone = 0;
+	while (st.parser.want != Parser<CheckBuilder<UndoUnionFind>>::Want::Done) {
+		if (i % st.interval == 0 && i > st.checkpoints.back().token) {
+			st.save(i);
+		}
+		Token t = lex.next();
+		st.tokens.push_back(std::make_pair(lex.position(t), t.text.size));
+		i++;
+		redone++;
+		if (!st.parser.feed(lex, t, st.builder, status)) {
+			break;
+		}
+	}
+	if (status.ok()) {
+		lex.finish();
+	}
+	rechecked += redone;
+	st.owed += redone;
+	st.builder.lex = &st.lex;
+	st.builder.status = &st.status;
+	if (!status.ok()) {
+		return SymbolTypes();
+	}
+	// A small edit that cost many tokens makes the region around it, so that the next edits near it cost only the
+	// region. That takes a pass over the whole expression, so it waits until the tokens re-checked since the last one
+	// add up to as many.
+	if (redone > st.max_rechecked && st.owed >= static_cast<long long>(st.tokens.size())
+		&& st.source.size() - suffix - diff <= st.region.max_bytes) {
+		st.region.rebuild(st.source, diff, st.source.size() - suffix);
+		st.owed = 0;
+	}
+	return st.builder.types(st.symbols);
+}
+
+// ================================================ session ===========================================================
+
+// CheckBuilder, also recording the symbols that occur in the line
+struct SessionBuilder : CheckBuilder<UndoUnionFind> {
+	typedef CheckBuilder<UndoUnionFind> Base;
+
+	SessionBuilder(Lexer &lex0, Status &status0) : Base(lex0, status0) {}
+	int var(Span name, int symbol) {
+		occurs.push_back(symbol);
+		return Base::var(name, symbol);
+	}
+	int binder(Span name, int symbol) {
+		occurs.push_back(symbol);
+		return Base::binder(name, symbol);
+	}
+
+	std::vector<int> occurs; // with repeats
+};
+
+struct Session::State {
+	State() : lex(nullptr, 0, symbols, status), builder(lex, status) {}
+
+	// Check the line, leaving only the symbols and the union-find changed. The changes since the last line are on
+	// their trails, so that an error can undo them.
+	bool check(Lexer &lex, Status &status) {
+		Parser<SessionBuilder> p;
+		Token t = lex.next();
+		int declared = -1, self = -1;
+		if (t.kind == TokenKind::Let) { // let <variable> = <expr>
+			Token name = lex.next();
+			if (name.kind == TokenKind::Error) {
+				return false;
+			}
+			if (name.kind != TokenKind::Name) {
+				return status.fail(ErrorKind::Syntax, lex.position(name),
+					"Syntax Error: The token following 'let' must be a variable.");
+			}
+			Token equal = lex.next();
+			if (equal.kind == TokenKind::Error) {
+				return false;
+			}
+			if (equal.kind != TokenKind::Equal) {
+				return status.fail(ErrorKind::Syntax, lex.position(equal),
+					"Syntax Error: missing = in let <variable> = <expr>");
+			}
+			declared = symbols.declare(name.value);
+			self = builder.binder(name.text, declared);
+			t = lex.next();
+		}
+		while (p.feed(lex, t, builder, status)) {
+			if (p.want == Parser<SessionBuilder>::Want::Done) {
+				if (!lex.finish()) {
+					return false;
+				}
+				if (declared != -1) {
+					builder.unify(self, p.result);
+					symbols.show(declared);
+				}
+				return status.ok();
+			}
+			t = lex.next();
+		}
+		return false;
+	}
+
+	SymbolTable symbols;
+	Status status; // only used between lines
+	Lexer lex;
+	SessionBuilder builder;
+	std::vector<long long> seen; // by symbol: the last line in which it occurred
+	std::unordered_map<int, int> generics; // by root: the generic type of its class in this line
+};
+
+Session::Session() : state(new State) {}
+
+Session::~Session() {}
+
+bool Session::processLine(const char *line, std::size_t size, std::string &out, Status &status) {
+	State &st = *state;
+	SessionBuilder &b = st.builder;
+	status = Status();
+	int symbols = st.symbols.size();
+	UndoUnionFind::Mark mark = b.uf.checkpoint();
+	Lexer lex(line, size, st.symbols, status);
+	b.lex = &lex;
+	b.status = &status;
+	b.occurs.clear();
+	bool ok = st.check(lex, status);
+	b.lex = &st.lex;
+	b.status = &st.status;
+	if (!ok) {
+		st.symbols.unscope(0);
+		for (int s : b.occurs) {
+			if (s < symbols && b.variable_number[s] >= mark.n) {
+				b.variable_number[s] = -1;
+			}
+		}
+		b.variable_number.resize(std::min<std::size_t>(b.variable_number.size(), symbols));
+		st.symbols.truncate(symbols);
+		b.uf.rollback(mark);
+		return false;
+	}
+	// The line is kept, so its changes can be forgotten.
+	st.symbols.scopes.clear();
+	b.uf.trail.clear();
+	lines++;
+
+	// the variables of the line, in order of first occurrence, which numbers their generic types
+	std::vector<int> order;
+	st.seen.resize(st.symbols.size(), 0);
+	st.generics.clear();
+	std::vector<int> types;
+	for (int s : b.occurs) {
+		if (st.seen[s] == lines) {
+			continue;
+		}
+		st.seen[s] = lines;
+		int r = b.uf.find(b.variable_number[s]);
+		order.push_back(s);
+		if (b.uf.type[r] != 0) {
+			types.push_back(b.uf.type[r]);
+		} else {
+			types.push_back(st.generics.emplace(r, st.generics.size()).first->second);
+		}
+	}
+	std::vector<int> by_name(order.size());
+	for (std::size_t i = 0; i < order.size(); i++) {
+		by_name[i] = i;
+	}
+	std::sort(by_name.begin(), by_name.end(), [&](int x, int y) -> bool {
+		Span a = st.symbols.name(order[x]), b = st.symbols.name(order[y]);
+		return a < b || (a == b && order[x] < order[y]);
+	});
+	for (int i : by_name) {
+		formatTyping(st.symbols.name(order[i]), types[i], out);
+	}
+	return true;
+}
+
+bool Session::processLine(const std::string &line, std::string &out, Status &status) {
+	return processLine(line.data(), line.size(), out, status);
+}
+
+// ================================================= cache ============================================================
+
+SymbolTypes CheckCache::check(const char *source, std::size_t size, SymbolTable &symbols, Status &status) {
+	if (capacity == 0) {
+		return typeinfer::check(source, size, symbols, status);
+	}
+	status = Status();
+	key.clear();
+	names.clear();
+	Lexer lex(source, size, names, status);
+	for (Token t = lex.next(); ; t = lex.next()) {
+		key += static_cast<char>(t.kind);
+		if (t.kind == TokenKind::Name) {
+			key.append(reinterpret_cast<const char*>(&t.value), sizeof t.value);
+		}
+		if (t.kind == TokenKind::End || t.kind == TokenKind::Error) {
+			break;
+		}
+	}
+	bool keyed = status.ok(); // a key cut short by a token error is not the key of the whole expression
+	auto it = keyed ? index.find(key) : index.end();
+	if (it != index.end()) {
+		hits++;
+		entries.splice(entries.begin(), entries, it->second);
+		const Result &r = it->second->second;
+		// The first symbol of each name is interned; the later ones are the variables of lets, declared from it.
+		symbols.clear();
+		std::vector<int> first(names.size(), -1);
+		for (int n : r.names) {
+			if (first[n] == -1) {
+				first[n] = symbols.intern(names.name(n));
+			} else {
+				symbols.declare(first[n]);
+			}
+		}
+		return r.types;
+	}
+	// A token error may come after the error that check() reports first, so it is checked again too.
+	misses++;
+	SymbolTypes types = typeinfer::check(source, size, symbols, status);
+	if (keyed && status.ok()) {
+		Result r{types, std::vector<int>(symbols.size())};
+		for (int s = 0; s < symbols.size(); s++) {
+			r.names[s] = names.find(symbols.name(s));
+		}
+		entries.emplace_front(key, std::move(r));
+		index[key] = entries.begin();
+		if (entries.size() > capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+	return types;
+}
+
+// ================================================= batch ============================================================
+
+void processRecord(const char *line, std::size_t size, std::string &out, BatchWorker &w) {
+	auto types = w.measure ? check(line, size, w.symbols, w.status, w.stats)
+		: w.cache.check(line, size, w.symbols, w.status);
+	double t0 = w.measure ? seconds() : 0;
+	if (w.status.ok()) {
+		formatTypes(types, w.symbols, out);
+	} else {
+		out += w.status.message;
+		out += '\n';
+	}
+	out += '\n';
+	if (w.measure) {
+		w.stats.format_seconds += seconds() - t0;
+	}
+}
+
+const char *expressionEnd(const char *begin, const char *end) {
+	if (*begin == ')') {
+		return begin + 1;
+	}
+	if (*begin != '(') {
+		while (begin < end && !iss(*begin) && *begin != '(' && *begin != ')') {
+			begin++;
+		}
+		return begin;
+	}
+	long long depth = 0;
+	for (; begin < end; begin++) {
+		if (*begin == '(') {
+			depth++;
+		} else if (*begin == ')' && --depth == 0) {
+			return begin + 1;
+		}
+	}
+	return end;
+}
+
+// the end of the first whitespace-separated expression in [begin, end), or end if there is none
+static const char *nextExpression(const char *begin, const char *end) {
+	begin = skipSpaces(begin, end);
+	return begin == end ? end : expressionEnd(begin, end);
+}
+
+// append the records of the lines in [begin, end), or of the expressions, to out
+static void processChunk(const char *begin, const char *end, bool expressions, std::string &out, BatchWorker &w) {
+	if (expressions) {
+		while ((begin = skipSpaces(begin, end)) < end) {
+			const char *e = expressionEnd(begin, end);
+			processRecord(begin, e - begin, out, w);
+			begin = e;
+		}
+		return;
+	}
+	while (begin < end) {
+		auto nl = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+		if (nl == nullptr) { // the last line without a trailing newline
+			processRecord(begin, end - begin, out, w);
+			break;
+		}
+		processRecord(begin, nl - begin, out, w);
+		begin = nl + 1;
+	}
+}
+
+// the chunks of one worker: it takes them from the front, and the others steal them from the back
+struct WorkQueue {
+	bool pop(int &chunk, bool steal) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (chunks.empty()) {
+			return false;
+		}
+		if (steal) {
+			chunk = chunks.back();
+			chunks.pop_back();
+		} else {
+			chunk = chunks.front();
+			chunks.pop_front();
+		}
+		return true;
+	}
+
+	std::mutex lock;
+	std::deque<int> chunks;
+};
+
+// processLines() or processExpressions()
+static void processRecords(const char *text, std::size_t size, bool expressions, std::vector<BatchWorker> &workers,
+	std::string &out) {
+	const std::size_t chunk_size = 1 << 16;
+	// chunk boundaries, at record boundaries (bounds[i] .. bounds[i + 1])
+	std::vector<const char*> bounds(1, text);
+	const char *end = text + size;
+	while (bounds.back() < end) {
+		const char *p = bounds.back() + std::min(chunk_size, static_cast<std::size_t>(end - bounds.back()));
+		if (expressions) {
+			const char *e = bounds.back();
+			while (e < p) {
+				e = nextExpression(e, end);
+			}
+			bounds.push_back(e);
+			continue;
+		}
+		auto nl = static_cast<const char*>(std::memchr(p - 1, '\n', end - (p - 1)));
+		bounds.push_back(nl == nullptr ? end : nl + 1);
+	}
+	int chunks = bounds.size() - 1;
+	int jobs = std::max(1, std::min(static_cast<int>(workers.size()), chunks));
+	if (jobs == 1) {
+		processChunk(text, end, expressions, out, workers[0]);
+		return;
+	}
+
+	// Each worker starts with a contiguous run of chunks, so that without stealing it reads the input in order.
+	std::vector<std::string> results(chunks);
+	std::vector<WorkQueue> queues(jobs);
+	for (int i = 0; i < chunks; i++) {
+		queues[static_cast<long long>(i) * jobs / chunks].chunks.push_back(i);
+	}
+	auto work = [&](int self) -> void {
+		int chunk;
+		for (int victim = self; victim < self + jobs; ) {
+			if (queues[victim % jobs].pop(chunk, victim != self)) {
+				processChunk(bounds[chunk], bounds[chunk + 1], expressions, results[chunk], workers[self]);
+			} else {
+				victim++; // No work is added during a run, so an empty queue stays empty.
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < jobs; i++) {
+		threads.emplace_back(work, i);
+	}
+	work(0);
+	for (auto &t : threads) {
+		t.join();
+	}
+	for (auto &r : results) {
+		out += r;
+	}
+}
+
+void processLines(const char *text, std::size_t size, std::vector<BatchWorker> &workers, std::string &out) {
+	processRecords(text, size, false, workers, out);
+}
+
+void processExpressions(const char *text, std::size_t size, std::vector<BatchWorker> &workers, std::string &out) {
+	processRecords(text, size, true, workers, out);
+}
+
+} // namespace typeinfer
@@ -0,0 +1,1266 @@
+/*
+ * typeinfer: the tokenizer, parser and type checker of the expression language below, as a library.
+ *
+ * Checking a line of text takes one call:
+ *   SymbolTable symbols;
+ *   Status status;
+ *   SymbolTypes types = check(source, symbols, status);   // empty unless status.ok()
+ *   int t = typeOf(types, symbols, "x");                  // INT, BOOL, a generic 0, 1, ..., or NO_TYPE
+ * The lower layers (Lexer, parse(), the AST and the three typecheck engines) are declared here as well, all of it in
+ * namespace typeinfer.
+ * A SymbolTable, Status and Arena can be reused from one expression to the next, but not shared between threads.
+ *
+ * # Grammar (LL1)
+ * <expr> := <variable> # any non-empty alphabetic sequences except for boolean literals and keywords
+ *                      # a let binds it in <expr2> only, hiding any variable of the same name there;
+ *                      # a name that no let binds is a free variable, the same one wherever it is free
+ *         | <integer> # 0 | 1 | -1 | ...
+ *                     # - 1 is invalid. The digits must immediately follow the negative sign.
+ *         | <boolean> # true | false
+ *         | ( - <expr1> <expr2> )
+ *         | ( * <expr1> <expr2> )
+ *         | ( / <expr1> <expr2> )
+ *         | ( < <expr1> <expr2> )
+ *         | ( + <expr1> <expr2> )
+ *         | ( && <expr1> <expr2> )
+ *         | ( || <expr1> <expr2> )
+ *         | ( ! <expr> )
+ *         | ( <= <expr1> <expr2> )
+ *         | ( > <expr1> <expr2> )
+ *         | ( >= <expr1> <expr2> )
+ *         | ( == <expr1> <expr2> )
+ *         | ( != <expr1> <expr2> )
+ *         | ( if <expr1> then <expr2> else <expr3> )
+ *         | ( let <variable> = <expr1> in <expr2> )
+ *
+ * # Type Constraints ([] represents the whole expression)
+ * <variable>                               :
+ * <integer>                                : [] = INT
+ * <boolean>                                : [] = BOOL
+ * ( - <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
+ * ( * <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
+ * ( / <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
+ * ( < <expr1> <expr2> )                    : [] = BOOL, [<expr1>] = [<expr2>] = INT
+ * ( + <expr1> <expr2> )                    : [] = INT, [<expr1>] = [<expr2>] = INT
+ * ( && <expr1> <expr2> )                   : [] = BOOL, [<expr1>] = [<expr2>] = BOOL
+ * ( || <expr1> <expr2> )                   : [] = BOOL, [<expr1>] = [<expr2>] = BOOL
+ * ( ! <expr> )                             : [] = BOOL, [<expr>] = BOOL
+ * ( <= <expr1> <expr2> )                   : [] = BOOL, [<expr1>] = [<expr2>] = INT
+ * ( > <expr1> <expr2> )                    : [] = BOOL, [<expr1>] = [<expr2>] = INT
+ * ( >= <expr1> <expr2> )                   : [] = BOOL, [<expr1>] = [<expr2>] = INT
+ * ( == <expr1> <expr2> )                   : [] = BOOL, [<expr1>] = [<expr2>] = INT
+ * ( != <expr1> <expr2> )                   : [] = BOOL, [<expr1>] = [<expr2>] = INT
+ * ( if <expr1> then <expr2> else <expr3> ) : [] = [<expr2>], [<expr1>] = BOOL, [<expr2>] = [<expr3>]
+ * ( let <variable> = <expr1> in <expr2> )  : [] = [<expr2>], [<variable>] = [<expr1>]
+ */
+
+/*
+ * The operators from + on give the same types as their encodings in the others, which they replace: one node whose
+ * operands are checked once, where an encoding takes several and may repeat its operands.
+ * (+ a b) := (- a (- 0 b))
+ * (&& <expr1> <expr2>) := (if <expr1> then <expr2> else false)
+ * (|| <expr1> <expr2>) := (if <expr1> then true else <expr2>)
+ * (! <expr>) := (if <expr> then false else true)
+ * (<= a b) := (! (< b a))
+ * (> a b) := (< b a)
+ * (>= a b) := (<= b a)
+ * (== a b) := (&& (! (< a b)) (! (< b a)))
+ * (!= a b) := (! (== a b))
+ */
+
+#ifndef TYPEINFER_H
+#define TYPEINFER_H
+
+#include <vector>
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <cstdint>
+#include <climits>
+#include <atomic>
+
+namespace typeinfer {
+
+// the stage that rejected an expression
+enum class ErrorKind : unsigned char {
+	None, Token, Syntax, Type
+};
+
+/*
+ * The outcome of checking an expression. Every stage stops at the first error, records it here and returns early;
+ * nothing is allocated unless there is an error.
+ */
+struct Status {
+	bool ok() const {
+		return kind == ErrorKind::None;
+	}
+	// record an error, returning false
+	bool fail(ErrorKind kind0, long position0, const std::string &message0) {
+		kind = kind0;
+		position = position0;
+		message = message0;
+		return false;
+	}
+
+	ErrorKind kind = ErrorKind::None;
+	long position = -1; // the offset in the source where the error was found, or -1 if unknown
+	std::string message;
+};
+
+// ================================================== memory ====================================================
+
+/*
+ * A bump allocator owning the AST of one expression.
+ * Objects are never destroyed one by one: reset() releases all of them at once by rewinding to the first block,
+ * so everything allocated here must be trivially destructible. The blocks themselves are kept for the next expression.
+ */
+struct Arena {
+	Arena() {}
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+	~Arena() {
+		for (auto b : blocks) {
+			delete[] b.first;
+		}
+	}
+
+	void *allocate(std::size_t size, std::size_t align) {
+		std::size_t pad = -reinterpret_cast<std::uintptr_t>(cur) & (align - 1);
+		if (static_cast<std::size_t>(end - cur) < pad + size) {
+			nextBlock(size + align);
+			pad = -reinterpret_cast<std::uintptr_t>(cur) & (align - 1);
+		}
+		char *r = cur + pad;
+		cur = r + size;
+		return r;
+	}
+	template<typename T, typename... Args> T *make(Args&&... args) {
+		static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed.");
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+	// release everything allocated so far
+	void reset() {
+		block = 0;
+		if (!blocks.empty()) {
+			cur = blocks[0].first;
+			end = cur + blocks[0].second;
+		}
+	}
+	// move on to the next block that can hold size bytes, allocating one if there is none
+	void nextBlock(std::size_t size) {
+		if (!blocks.empty()) {
+			block++;
+		}
+		while (block < blocks.size() && blocks[block].second < size) {
+			block++;
+		}
+		if (block == blocks.size()) {
+			std::size_t n = size > block_size ? size : block_size;
+			blocks.push_back(std::make_pair(new char[n], n));
+		}
+		cur = blocks[block].first;
+		end = cur + blocks[block].second;
+	}
+
+	static const std::size_t block_size = 1 << 16;
+
+	std::vector<std::pair<char*, std::size_t>> blocks; // (memory, size)
+	std::size_t block = 0; // the block being filled
+	char *cur = nullptr, *end = nullptr; // the free part of that block
+};
+
+// ================================================== tokenizing =================================================
+
+// a piece of the source text, which it does not own
+struct Span {
+	std::string str() const {
+		return std::string(data, size);
+	}
+	bool operator==(const char *s) const {
+		return std::strlen(s) == size && std::memcmp(data, s, size) == 0;
+	}
+	bool operator==(const Span &o) const {
+		return size == o.size && std::memcmp(data, o.data, size) == 0;
+	}
+	bool operator<(const Span &o) const { // the order of std::string
+		int c = std::memcmp(data, o.data, std::min(size, o.size));
+		return c < 0 || (c == 0 && size < o.size);
+	}
+
+	const char *data;
+	std::size_t size;
+};
+
+/*
+ * Interns variable names as dense symbols 0, 1, 2, ... in order of first appearance, so that the passes after the
+ * tokenizer can index plain vectors by symbol instead of comparing names.
+ * The names are copied into one buffer and found through an open-addressing hash table.
+ * A symbol is one variable, not one name: the parser declares a new symbol for the variable of each let, and shows it
+ * in place of the symbol of the same name while its body is being read, so the lexer returns the variable in scope.
+ * The changes of scope are kept on a trail, so that they can be rolled back with the symbols declared after them.
+ */
+struct SymbolTable {
+	SymbolTable() : table(16, -1) {}
+
+	int size() const {
+		return offsets.size();
+	}
+	Span name(int symbol) const {
+		return Span{text.data() + offsets[symbol], lengths[symbol]};
+	}
+	// the symbol of name, adding it if it is new
+	int intern(Span name) {
+		std::size_t h = hash(name);
+		std::size_t mask = table.size() - 1;
+		for (std::size_t i = h & mask; ; i = (i + 1) & mask) {
+			int s = table[i];
+			if (s == -1) {
+				break;
+			}
+			if (hashes[s] == h && this->name(s) == name) {
+				return s;
+			}
+		}
+		int s = size();
+		offsets.push_back(text.size());
+		lengths.push_back(name.size);
+		hashes.push_back(h);
+		text.append(name.data, name.size);
+		if (2 * offsets.size() > table.size()) {
+			rehash(2 * table.size());
+		}
+		insert(s);
+		return s;
+	}
+	// a new symbol with the name of s, for a let that binds it; it stays hidden until it is shown
+	int declare(int s) {
+		int d = size();
+		offsets.push_back(text.size());
+		lengths.push_back(lengths[s]);
+		hashes.push_back(hashes[s]);
+		text.append(text, offsets[s], lengths[s]);
+		if (2 * offsets.size() > table.size()) {
+			rehash(2 * table.size());
+		}
+		return d;
+	}
+	// make the declared symbol d the one that its name is interned as, returning the one it hides
+	int show(int d) {
+		int &slot = slotOfName(d);
+		int hidden = slot;
+		slot = d;
+		scopes.push_back(std::make_pair(hidden, d));
+		return hidden;
+	}
+	// undo show(d), which returned hidden
+	void hide(int d, int hidden) {
+		slotOfName(d) = hidden;
+		scopes.push_back(std::make_pair(d, hidden));
+	}
+	// undo the shows and hides after the first n of them
+	void unscope(std::size_t n) {
+		while (scopes.size() > n) {
+			slotOfName(scopes.back().second) = scopes.back().first;
+			scopes.pop_back();
+		}
+	}
+	// the slot of the symbol that the name of s is interned as, which must exist
+	int &slotOfName(int s) {
+		std::size_t mask = table.size() - 1;
+		std::size_t i = hashes[s] & mask;
+		while (table[i] == -1 || hashes[table[i]] != hashes[s] || !(name(table[i]) == name(s))) {
+			i = (i + 1) & mask;
+		}
+		return table[i];
+	}
+	// the symbol of name, or -1 if it has not been interned
+	int find(Span name) const {
+		std::size_t h = hash(name);
+		std::size_t mask = table.size() - 1;
+		for (std::size_t i = h & mask; table[i] != -1; i = (i + 1) & mask) {
+			int s = table[i];
+			if (hashes[s] == h && this->name(s) == name) {
+				return s;
+			}
+		}
+		return -1;
+	}
+	// forget the symbols from n on, which must not be shown (see unscope())
+	void truncate(int n) {
+		for (int s = size() - 1; s >= n; s--) {
+			std::size_t mask = table.size() - 1;
+			std::size_t i = hashes[s] & mask;
+			while (table[i] != s && table[i] != -1) { // A declared symbol has no slot of its own.
+				i = (i + 1) & mask;
+			}
+			if (table[i] == -1) {
+				continue;
+			}
+			// Empty the slot, moving back the symbols after it that would no longer be found past the gap.
+			for (std::size_t j = (i + 1) & mask; table[j] != -1; j = (j + 1) & mask) {
+				std::size_t home = hashes[table[j]] & mask;
+				if (((j - home) & mask) >= ((j - i) & mask)) {
+					table[i] = table[j];
+					i = j;
+				}
+			}
+			table[i] = -1;
+		}
+		if (n < size()) {
+			text.resize(offsets[n]);
+			offsets.resize(n);
+			lengths.resize(n);
+			hashes.resize(n);
+		}
+	}
+	// forget all symbols, keeping the memory
+	void clear() {
+		text.clear();
+		offsets.clear();
+		lengths.clear();
+		hashes.clear();
+		scopes.clear();
+		std::fill(table.begin(), table.end(), -1);
+	}
+
+	static std::size_t hash(Span name) { // FNV-1a
+		std::size_t h = 14695981039346656037ULL;
+		for (std::size_t i = 0; i < name.size; i++) {
+			h = (h ^ static_cast<unsigned char>(name.data[i])) * 1099511628211ULL;
+		}
+		return h;
+	}
+	void insert(int s) {
+		std::size_t mask = table.size() - 1;
+		std::size_t i = hashes[s] & mask;
+		while (table[i] != -1) {
+			i = (i + 1) & mask;
+		}
+		table[i] = s;
+	}
+	void rehash(std::size_t n) { // keeping exactly the symbols that are shown
+		std::vector<char> shown(size());
+		for (int s : table) {
+			if (s != -1 && s < size()) {
+				shown[s] = true;
+			}
+		}
+		table.assign(n, -1);
+		for (int s = 0; s < size(); s++) {
+			if (shown[s]) {
+				insert(s);
+			}
+		}
+	}
+
+	std::string text; // all names, back to back
+	std::vector<std::size_t> offsets, lengths; // where each symbol's name is in text
+	std::vector<std::size_t> hashes; // the hash of each symbol's name
+	std::vector<int> table; // symbols by hash, -1 for empty slots; the size is a power of 2
+	std::vector<std::pair<int, int>> scopes; // each change of the symbol in a slot: (before, after)
+};
+
+// the token types
+enum class TokenKind : unsigned char {
+	Name, Int, Bool, // variable names and literals
+	LParen, RParen,
+	// the operators, in the order of their NodeKinds
+	Minus, Star, Slash, Less, Plus, And, Or, Not, LessEqual, Greater, GreaterEqual, EqualEqual, NotEqual,
+	Equal, If, Then, Else, Let, In, // the other reserved tokens
+	End, // the end of the source
+	Error // a token error, recorded in the status of the lexer
+};
+
+struct Token {
+	TokenKind kind;
+	int value; // the value of an integer or boolean literal, or the symbol of a variable name
+	Span text; // where the token is in the source
+};
+
+/*
+ * variable names: [a-zA-Z]+
+ * boolean literal: true | false
+ * integer literal: -?[0-9]+
+ * reserved tokens: ( ) - * / < + && || ! <= > >= == != if then else let = in
+ */
+
+/*
+ * The tokenizer is a pull iterator over the source: every next() scans one more token, so there is no token queue and
+ * tokens are plain values pointing into the source, which must outlive them. Variable names are interned into symbols.
+ * An Error token is followed by End.
+ */
+struct Lexer {
+	Lexer(const char *source0, std::size_t size0, SymbolTable &symbols0, Status &status0)
+		: source(source0), size(size0), symbols(symbols0), status(status0) {}
+	Lexer(const std::string &source0, SymbolTable &symbols0, Status &status0)
+		: Lexer(source0.data(), source0.size(), symbols0, status0) {}
+
+	// scan the next token
+	Token next() {
+		return scan<true>();
+	}
+	// scan the next token, interning its name if it is a variable and intern is true (else its value is 0)
+	template<bool intern> Token scan();
+
+	// lex the rest of the source, which follows the expression, for its token errors without interning its names;
+	// false if it has one
+	bool finish();
+
+	// the kind of an alphabetic word, and the value of a boolean literal; only the keywords of its length are compared
+	static TokenKind word(Span w, int &value) {
+		switch (w.size) {
+		case 2:
+			if (w.data[0] == 'i' && w.data[1] == 'f') {
+				return TokenKind::If;
+			} else if (w.data[0] == 'i' && w.data[1] == 'n') {
+				return TokenKind::In;
+			}
+			break;
+		case 3:
+			if (std::memcmp(w.data, "let", 3) == 0) {
+				return TokenKind::Let;
+			}
+			break;
+		case 4:
+			if (std::memcmp(w.data, "then", 4) == 0) {
+				return TokenKind::Then;
+			} else if (std::memcmp(w.data, "else", 4) == 0) {
+				return TokenKind::Else;
+			} else if (std::memcmp(w.data, "true", 4) == 0) {
+				value = 1;
+				return TokenKind::Bool;
+			}
+			break;
+		case 5:
+			if (std::memcmp(w.data, "false", 5) == 0) {
+				value = 0;
+				return TokenKind::Bool;
+			}
+			break;
+		}
+		return TokenKind::Name;
+	}
+
+	// the token of two characters at pos if its second one is second, else the token of the first one alone (or, if
+	// that is Error, a token error)
+	TokenKind pair(char second, TokenKind two, TokenKind one) {
+		if (pos + 1 < size && source[pos + 1] == second) {
+			pos += 2;
+			return two;
+		}
+		if (one == TokenKind::Error) {
+			return unrecognized();
+		}
+		pos++;
+		return one;
+	}
+
+	// record a token error for the character at pos
+	TokenKind unrecognized() {
+		return error(pos, std::string("Token Error: unrecognized character '") + source[pos] + "' at position "
+			+ std::to_string(pos));
+	}
+
+	// record a token error at start and skip the rest of the source
+	TokenKind error(std::size_t start, const std::string &message) {
+		status.fail(ErrorKind::Token, start, message);
+		pos = size;
+		return TokenKind::Error;
+	}
+
+	// scan the integer literal -?[0-9]+ starting at pos, which is an error if it is out of range
+	TokenKind number(std::size_t start, int &value);
+
+	// the position of a token in the source
+	std::size_t position(const Token &t) const {
+		return t.text.data - source;
+	}
+
+	const char *source;
+	std::size_t size;
+	SymbolTable &symbols;
+	Status &status;
+	std::size_t pos = 0; // where the next token starts
+};
+
+// print the tokens of source, one per line
+void printTokens(const std::string &source);
+
+// =========================================== parsing ================================================
+
+// the AST node types, stored in every node so that traversals can switch on them
+enum class NodeKind : unsigned char {
+	Var, Int, Bool,
+	Sub, Mul, Div, Lt, Add, And, Or, Not, Le, Gt, Ge, Eq, Ne, // the operators, from FIRST_OPERATOR to LAST_OPERATOR
+	If, Let
+};
+
+const NodeKind FIRST_OPERATOR = NodeKind::Sub, LAST_OPERATOR = NodeKind::Ne;
+
+// Type variables are numbered 0, 1, 2, ... In constraints and in UnionFind::type, INT and BOOL stand for the proper types.
+const int INT = -2;
+const int BOOL = -1;
+
+/*
+ * An operator ( op <expr1> ... ) of arity subexpressions, whose constraints are [] = result and [<expr1>] = ... =
+ * operand. It is the grammar and the type rule of the operator at once: the parser, the AST and every type check take
+ * them from here, so an operator is added by adding its row (and its token to the lexer).
+ */
+struct OperatorRule {
+	NodeKind kind;
+	TokenKind token;
+	const char *symbol; // in the source
+	const char *name; // of its AST node
+	int arity;
+	int operand, result; // INT or BOOL
+};
+
+// the operators, in the order of their NodeKinds
+constexpr OperatorRule operator_rules[] = {
+	{NodeKind::Sub, TokenKind::Minus, "-", "Sub", 2, INT, INT},
+	{NodeKind::Mul, TokenKind::Star, "*", "Mul", 2, INT, INT},
+	{NodeKind::Div, TokenKind::Slash, "/", "Div", 2, INT, INT},
+	{NodeKind::Lt, TokenKind::Less, "<", "Lt", 2, INT, BOOL},
+	{NodeKind::Add, TokenKind::Plus, "+", "Add", 2, INT, INT},
+	{NodeKind::And, TokenKind::And, "&&", "And", 2, BOOL, BOOL},
+	{NodeKind::Or, TokenKind::Or, "||", "Or", 2, BOOL, BOOL},
+	{NodeKind::Not, TokenKind::Not, "!", "Not", 1, BOOL, BOOL},
+	{NodeKind::Le, TokenKind::LessEqual, "<=", "Le", 2, INT, BOOL},
+	{NodeKind::Gt, TokenKind::Greater, ">", "Gt", 2, INT, BOOL},
+	{NodeKind::Ge, TokenKind::GreaterEqual, ">=", "Ge", 2, INT, BOOL},
+	{NodeKind::Eq, TokenKind::EqualEqual, "==", "Eq", 2, INT, BOOL},
+	{NodeKind::Ne, TokenKind::NotEqual, "!=", "Ne", 2, INT, BOOL},
+};
+
+constexpr bool isOperator(NodeKind k) {
+	return k >= FIRST_OPERATOR && k <= LAST_OPERATOR;
+}
+// the rule of an operator
+constexpr const OperatorRule &rule(NodeKind k) {
+	return operator_rules[static_cast<int>(k) - static_cast<int>(FIRST_OPERATOR)];
+}
+// whether a token is an operator, and which one: the operator tokens are in the order of the operators
+constexpr bool isOperator(TokenKind t) {
+	return t >= rule(FIRST_OPERATOR).token && t <= rule(LAST_OPERATOR).token;
+}
+constexpr NodeKind operatorOf(TokenKind t) {
+	return static_cast<NodeKind>(static_cast<int>(FIRST_OPERATOR) + static_cast<int>(t)
+		- static_cast<int>(rule(FIRST_OPERATOR).token));
+}
+
+// whether the rows from i on are where rule() and operatorOf() look for them
+constexpr bool rulesInOrder(int i = 0) {
+	return i == sizeof operator_rules / sizeof operator_rules[0] ? i == 1 + static_cast<int>(LAST_OPERATOR)
+		- static_cast<int>(FIRST_OPERATOR) : operatorOf(operator_rules[i].token) == operator_rules[i].kind
+		&& rule(operator_rules[i].kind).kind == operator_rules[i].kind && rulesInOrder(i + 1);
+}
+static_assert(rulesInOrder(), "operator_rules must follow the order of the operators and of their tokens");
+
+struct Node {
+	Node(NodeKind kind0) : kind(kind0) {}
+	virtual std::string getLiteral() {
+		return "";
+	}
+
+	const NodeKind kind;
+
+	// the pre-order BFS number
+	int number = -1;
+};
+
+// the literal of the AST at root, as getLiteral() gives it, built on an explicit stack so deep trees do not overflow
+// the native one
+std::string astLiteral(Node *root);
+
+struct Var : public Node {
+	Var(Span val0, int symbol0) : Node(NodeKind::Var), val(val0), symbol(symbol0) {}
+	std::string getLiteral() override {
+		return "[Var " + val.str() + "]";
+	}
+
+	Span val; // in the source
+	int symbol;
+};
+
+struct Int : public Node {
+	Int(int val0) : Node(NodeKind::Int), val(val0) {}
+	std::string getLiteral() override {
+		return "[Int " + std::to_string(val) + "]";
+	}
+
+	int val;
+};
+
+struct Bool : public Node {
+	Bool(bool val0) : Node(NodeKind::Bool), val(val0) {}
+	std::string getLiteral() override {
+		return "[Bool " + std::string(val ? "true" : "false") + "]";
+	}
+
+	bool val;
+};
+
+// ( op <expr1> <expr2> ) for any operator; n2 is nullptr if it is unary
+struct Operation : public Node {
+	Operation(NodeKind kind0, Node *n10, Node *n20) : Node(kind0), n1(n10), n2(n20) {}
+	std::string getLiteral() override {
+		return astLiteral(this);
+	}
+
+	Node *n1, *n2;
+};
+
+// the node of one operator, for building an AST by hand
+template<NodeKind K> struct OperatorNode : public Operation {
+	static_assert(isOperator(K), "not an operator");
+	OperatorNode(Node *n10, Node *n20 = nullptr) : Operation(K, n10, n20) {}
+};
+
+typedef OperatorNode<NodeKind::Sub> Sub;
+typedef OperatorNode<NodeKind::Mul> Mul;
+typedef OperatorNode<NodeKind::Div> Div;
+typedef OperatorNode<NodeKind::Lt> Lt;
+typedef OperatorNode<NodeKind::Add> Add;
+typedef OperatorNode<NodeKind::And> And;
+typedef OperatorNode<NodeKind::Or> Or;
+typedef OperatorNode<NodeKind::Not> Not;
+typedef OperatorNode<NodeKind::Le> Le;
+typedef OperatorNode<NodeKind::Gt> Gt;
+typedef OperatorNode<NodeKind::Ge> Ge;
+typedef OperatorNode<NodeKind::Eq> Eq;
+typedef OperatorNode<NodeKind::Ne> Ne;
+
+// the nodes with three children, if and let, for traversing either one
+struct Ternary : public Node {
+	Ternary(NodeKind kind0, Node *n10, Node *n20, Node *n30) : Node(kind0), n1(n10), n2(n20), n3(n30) {}
+
+	Node *n1, *n2, *n3;
+};
+
+struct If : public Ternary {
+	If(Node *n10, Node *n20, Node *n30) : Ternary(NodeKind::If, n10, n20, n30) {}
+	std::string getLiteral() override {
+		return astLiteral(this);
+	}
+};
+
+struct Let : public Ternary {
+	Let(Node *n10, Node *n20, Node *n30) : Ternary(NodeKind::Let, n10, n20, n30) {}
+	std::string getLiteral() override {
+		return astLiteral(this);
+	}
+};
+
+// the AST of one expression, allocated in arena, or nullptr on error
+Node *parse(Lexer &lex, Arena &arena, Status &status);
+
+// print an AST on one line
+void printAST(Node *root);
+
+// =========================================== type inference and type check ==========================================
+
+// the hooks of BasicUnionFind that do nothing, for UnionFind
+struct NoUnionFindHooks {
+	void onConstraint() {}
+	void onFindStep() {}
+	void onCompress() {}
+};
+
+/*
+ * Union-find over type variables, with union by size and path halving.
+ * The proper type of a class (INT or BOOL) is a tag kept at its root, so it never decides which element is the root.
+ * Hooks is told of every join or assign, every step of find() and every write of path halving; it is a base, so
+ * the empty NoUnionFindHooks of UnionFind takes no space and its calls compile to nothing.
+ */
+template<typename Hooks> struct BasicUnionFind : Hooks {
+	BasicUnionFind(int n0) : n(n0), prev(n0), size(n0, 1), type(n0, 0) {
+		for (int i = 0; i < n0; i++) {
+			prev[i] = i;
+		}
+	}
+	// add a singleton class, returning its element
+	int add() {
+		prev.push_back(n);
+		size.push_back(1);
+		type.push_back(0);
+		return n++;
+	}
+	int find(int x) {
+		while (prev[x] != x) {
+			this->onFindStep();
+			if (prev[x] != prev[prev[x]]) {
+				this->onCompress();
+			}
+			prev[x] = prev[prev[x]];
+			x = prev[x];
+		}
+		return x;
+	}
+	// merge the classes of x and y, unless they have different proper types
+	bool join(int x, int y) {
+		this->onConstraint();
+		int rx = find(x);
+		int ry = find(y);
+		if (rx == ry) {
+			return true;
+		}
+		if (type[rx] != 0 && type[ry] != 0 && type[rx] != type[ry]) {
+			return false;
+		}
+		if (size[rx] > size[ry]) {
+			std::swap(rx, ry);
+		}
+		prev[rx] = ry;
+		size[ry] += size[rx];
+		if (type[ry] == 0) {
+			type[ry] = type[rx];
+		}
+		return true;
+	}
+	// give the class of x the proper type t, unless it already has the other one
+	bool assign(int x, int t) {
+		this->onConstraint();
+		int r = find(x);
+		if (type[r] != 0 && type[r] != t) {
+			return false;
+		}
+		type[r] = t;
+		return true;
+	}
+
+	int n = 0;
+	std::vector<int> prev;
+	std::vector<int> size; // the size of each class, kept at its root
+	std::vector<int> type; // the proper type of each class (INT, BOOL, or 0 if none yet), kept at its root
+};
+
+typedef BasicUnionFind<NoUnionFindHooks> UnionFind;
+
+/*
+ * Union-find with the interface of UnionFind that can be rolled back to a checkpoint, for speculative and scoped
+ * unification. It uses union by rank without path compression, so find() is O(log n) and changes nothing, and every
+ * change is logged on a trail; rolling back costs the number of changes undone.
+ */
+struct UndoUnionFind {
+	// the state to roll back to
+	struct Mark {
+		std::size_t trail;
+		int n;
+	};
+
+	UndoUnionFind(int n0) {
+		for (int i = 0; i < n0; i++) {
+			add();
+		}
+	}
+	int add() {
+		prev.push_back(n);
+		rank.push_back(0);
+		type.push_back(0);
+		return n++;
+	}
+	int find(int x) const {
+		while (prev[x] != x) {
+			x = prev[x];
+		}
+		return x;
+	}
+	bool join(int x, int y) {
+		int rx = find(x);
+		int ry = find(y);
+		if (rx == ry) {
+			return true;
+		}
+		if (type[rx] != 0 && type[ry] != 0 && type[rx] != type[ry]) {
+			return false;
+		}
+		if (rank[rx] > rank[ry]) {
+			std::swap(rx, ry);
+		}
+		log(rx);
+		log(ry);
+		prev[rx] = ry;
+		rank[ry] += rank[rx] == rank[ry];
+		if (type[ry] == 0) {
+			type[ry] = type[rx];
+		}
+		return true;
+	}
+	bool assign(int x, int t) {
+		int r = find(x);
+		if (type[r] != 0 && type[r] != t) {
+			return false;
+		}
+		if (type[r] == 0) {
+			log(r);
+			type[r] = t;
+		}
+		return true;
+	}
+
+	Mark checkpoint() const {
+		return Mark{trail.size(), n};
+	}
+	// undo every add, join and assign since the checkpoint m was taken
+	void rollback(Mark m) {
+		while (trail.size() > m.trail) {
+			const Change &c = trail.back();
+			prev[c.x] = c.prev;
+			rank[c.x] = c.rank;
+			type[c.x] = c.type;
+			trail.pop_back();
+		}
+		n = m.n;
+		prev.resize(n);
+		rank.resize(n);
+		type.resize(n);
+	}
+
+	// the state of one element before a change
+	struct Change {
+		int x, prev, rank, type;
+	};
+	void log(int x) {
+		trail.push_back(Change{x, prev[x], rank[x], type[x]});
+	}
+
+	int n = 0;
+	std::vector<int> prev;
+	std::vector<int> rank; // an upper bound on the height of each class, kept at its root
+	std::vector<int> type;
+	std::vector<Change> trail;
+};
+
+/*
+ * Union-find over type variables that any number of threads can use at once, lock-free. Each element is one atomic
+ * word: its parent, or at a root its proper type. A join links one root under the other with a compare-and-swap of
+ * the lower root's word, and starts over if that root was linked or typed meanwhile; find() halves paths with
+ * compare-and-swaps that may fail harmlessly. Which of two roots goes under the other is decided by a fixed
+ * pseudo-random priority of the elements, which keeps paths short without sizes to maintain.
+ * A class never loses its proper type, so a join may copy the type of one root to the other before linking them.
+ * Conflicting proper types fail a join or assign as in UnionFind, whose interface it has, except that its size is
+ * fixed.
+ */
+struct ConcurrentUnionFind {
+	ConcurrentUnionFind(int n0) : n(n0), word(n0) {
+		for (auto &w : word) {
+			w.store(root(0), std::memory_order_relaxed);
+		}
+	}
+	// type points back to the object, which therefore stays where it was made
+	ConcurrentUnionFind(const ConcurrentUnionFind &) = delete;
+	ConcurrentUnionFind &operator=(const ConcurrentUnionFind &) = delete;
+	int find(int x) {
+		while (true) {
+			int p = word[x].load(std::memory_order_acquire);
+			if (p < 0) {
+				return x;
+			}
+			int g = word[p].load(std::memory_order_acquire);
+			if (g < 0) {
+				return p;
+			}
+			word[x].compare_exchange_weak(p, g, std::memory_order_release, std::memory_order_relaxed);
+			x = g;
+		}
+	}
+	bool join(int x, int y) {
+		while (true) {
+			int rx = find(x), ry = find(y);
+			if (rx == ry) {
+				return true;
+			}
+			if (priority(rx) > priority(ry)) { // rx goes under ry
+				std::swap(rx, ry);
+			}
+			int wx = word[rx].load(std::memory_order_acquire), wy = word[ry].load(std::memory_order_acquire);
+			if (wx >= 0 || wy >= 0) { // no longer a root
+				continue;
+			}
+			if (wx != root(0) && wy != root(0) && wx != wy) {
+				return false;
+			}
+			bool copy = wx != root(0) && wy == root(0); // the type of rx, to ry
+			if (copy && !word[ry].compare_exchange_strong(wy, wx, std::memory_order_acq_rel)) {
+				continue;
+			}
+			if (word[rx].compare_exchange_strong(wx, ry, std::memory_order_acq_rel)) {
+				return true;
+			}
+		}
+	}
+	bool assign(int x, int t) {
+		while (true) {
+			int r = find(x);
+			int w = word[r].load(std::memory_order_acquire);
+			if (w >= 0) {
+				continue;
+			}
+			if (w != root(0)) {
+				return w == root(t);
+			}
+			if (word[r].compare_exchange_strong(w, root(t), std::memory_order_acq_rel)) {
+				return true;
+			}
+		}
+	}
+
+	// the word of a root of proper type t (or 0): negative, unlike parents
+	static int root(int t) {
+		return t - 1;
+	}
+	// a bijection of the elements, scrambling their order
+	static unsigned priority(int x) {
+		return static_cast<unsigned>(x) * 2654435761u;
+	}
+
+	// the proper type of the class of each root (INT, BOOL, or 0 if none yet), read like UnionFind::type
+	struct Types {
+		int operator[](int r) const {
+			int w = uf->word[r].load(std::memory_order_acquire);
+			return w < 0 ? w + 1 : 0;
+		}
+		const ConcurrentUnionFind *uf;
+	};
+
+	int n;
+	std::vector<std::atomic<int>> word;
+	Types type{this};
+};
+
+// the name of a proper type
+std::string properTypeName(int t);
+
+// Apply the constraint x = y, where x is a type variable and y is a type variable, INT or BOOL.
+// On a conflict, records a type error without position and returns false.
+bool unify(UnionFind &uf, int x, int y, Status &status);
+bool unify(UndoUnionFind &uf, int x, int y, Status &status);
+bool unify(ConcurrentUnionFind &uf, int x, int y, Status &status);
+
+/*
+ * The result of a type check: the solved type of every symbol, which is INT, BOOL, or a generic type numbered 0, 1,
+ * 2, ... in the order of the first symbol of each class, so the numbering depends only on the classes found and not
+ * on the engine or the order of unification. NO_TYPE marks the symbols that do not occur in the expression.
+ */
+const int NO_TYPE = -3;
+typedef std::vector<int> SymbolTypes;
+
+// append the name of a solved type to out
+void formatType(int t, std::string &out);
+
+// This is a general function for traversing the AST and applying f to each node, in pre-order, until f returns false.
+// The pending subtrees are kept on an explicit stack, so deep trees do not overflow the native one.
+template<typename F> bool dfs(Node *root, F f) {
+	std::vector<Node*> stack(1, root);
+	while (!stack.empty()) {
+		Node *cur = stack.back();
+		stack.pop_back();
+		if (!f(cur)) {
+			return false;
+		}
+		switch (cur->kind) {
+		case NodeKind::Var:
+		case NodeKind::Int:
+		case NodeKind::Bool: // leaves
+			break;
+		case NodeKind::If:
+		case NodeKind::Let: {
+			auto r = static_cast<Ternary*>(cur);
+			stack.push_back(r->n3);
+			stack.push_back(r->n2);
+			stack.push_back(r->n1);
+			break;
+		}
+		default: { // operators
+			auto r = static_cast<Operation*>(cur);
+			if (r->n2) {
+				stack.push_back(r->n2);
+			}
+			stack.push_back(r->n1);
+			break;
+		}
+		}
+	}
+	return true;
+}
+
+// This function does both type inference and type check. The result is empty unless status is ok afterwards; the
+// AST does not know where its nodes are in the source, so its errors have no position.
+SymbolTypes typecheck(Node *root, const SymbolTable &symbols, Status &status);
+
+// ================================================= flat AST =========================================================
+
+/*
+ * The AST in pre-order, stored as parallel arrays indexed by node.
+ * The first child of node i (if any) is always i + 1; the second and third children are recorded explicitly.
+ * Every pass over a FlatAst is a linear scan instead of a pointer chase.
+ */
+struct FlatAst {
+	int size() const {
+		return kind.size();
+	}
+	// append a node without children
+	int push(NodeKind k, int v) {
+		kind.push_back(k);
+		child2.push_back(-1);
+		child3.push_back(-1);
+		value.push_back(v);
+		number.push_back(-1);
+		return size() - 1;
+	}
+
+	std::vector<NodeKind> kind;
+	std::vector<int> child2, child3; // -1 if absent
+	std::vector<int> value; // integer literal, boolean literal, or the symbol of a variable
+	std::vector<int> number; // the type variable of each node, assigned by typecheck
+};
+
+FlatAst flatten(Node *root);
+
+// typecheck() on the flat AST: the same numbering, constraints and results, computed by linear scans
+SymbolTypes typecheck(FlatAst &ast, const SymbolTable &symbols, Status &status);
+
+/*
+ * typecheck() on the flat AST with up to jobs threads. The largest subtrees of at most about 1/(8 jobs) of the nodes
+ * are checked in parallel, each numbered and solved on its own; only the classes of their roots and of their
+ * variables reach the nodes above them, through a ConcurrentUnionFind where each thread unifies them as it finishes
+ * a subtree. The nodes above are checked last, in the same union-find.
+ * The types are the same as typecheck(), but of two type errors, either may be the one reported. ast.number is not
+ * used.
+ */
+SymbolTypes typecheckParallel(const FlatAst &ast, const SymbolTable &symbols, Status &status, int jobs);
+
+// ================================================ AST image =========================================================
+
+/*
+ * A flat AST with its symbols, and optionally their solved types, as one binary file that is used where it lies: a
+ * stored expression can be mapped and checked again (or, with the types, queried) without tokenizing or parsing it.
+ * The layout, in the byte order of the writer, every part starting at a multiple of 4:
+ *   header                  "TIFA", version, nodes, symbols, name bytes, flags (uint32 each)
+ *   kinds                   uint8 per node (NodeKind)
+ *   child2, child3, values  int32 per node, as in FlatAst
+ *   offsets, lengths        uint32 per symbol, of its name
+ *   types                   int32 per symbol, only with AST_IMAGE_TYPES
+ *   names                   all of them, back to back
+ * A reader of the other byte order sees a version it does not know, and rejects the image.
+ */
+const std::uint32_t AST_IMAGE_VERSION = 2; // 2: the operators from + on
+const std::uint32_t AST_IMAGE_TYPES = 1; // flag: the solved types follow the symbols
+
+// append the image of ast and symbols to out, with the types of a successful check if types is not null
+void writeAstImage(const FlatAst &ast, const SymbolTable &symbols, const SymbolTypes *types, std::string &out);
+
+// A FlatAst read in place from an image, with the same arrays (as pointers into it) except number.
+struct AstImage {
+	// Point into the image at data, which must be 4-byte aligned and outlive this. The whole image is checked first,
+	// so that a damaged one cannot send a check out of bounds; false (with error set) if it is not valid.
+	bool load(const char *data, std::size_t size, std::string &error);
+
+	int size() const {
+		return nodes;
+	}
+	Span name(int symbol) const {
+		return Span{names + offsets[symbol], lengths[symbol]};
+	}
+	// replace out with the symbols of the image, numbered as they were when it was written
+	void symbolTable(SymbolTable &out) const;
+
+	int nodes = 0, symbols = 0;
+	const NodeKind *kind = nullptr;
+	const int *child2 = nullptr, *child3 = nullptr, *value = nullptr;
+	const std::uint32_t *offsets = nullptr, *lengths = nullptr;
+	const int *types = nullptr; // the solved types of the symbols, unless the image has none
+	const char *names = nullptr;
+};
+
+// typecheck() and typecheckParallel() on an image, ignoring its stored types
+SymbolTypes typecheck(const AstImage &ast, Status &status);
+SymbolTypes typecheckParallel(const AstImage &ast, Status &status, int jobs);
+
+// formatTypes() with the names in an image, without a SymbolTable
+void formatTypes(const SymbolTypes &types, const AstImage &image, std::string &out);
+
+// ============================================ fused type check ======================================================
+
+// parse and typecheck the tokens in a single pass, without an AST; the result is empty unless status is ok afterwards
+SymbolTypes parseAndTypecheck(Lexer &lex, Status &status);
+
+// =============================================== front end ==========================================================
+
+// check one expression in source with parseAndTypecheck(); symbols and status are cleared first
+SymbolTypes check(const char *source, std::size_t size, SymbolTable &symbols, Status &status);
+SymbolTypes check(const std::string &source, SymbolTable &symbols, Status &status);
+
+// the type of the first variable called name in a check result, or NO_TYPE if it does not occur
+int typeOf(const SymbolTypes &types, const SymbolTable &symbols, const std::string &name);
+
+// append "name :: TYPE" lines to out, in the order of the names, and of the variables of the same name
+void formatTypes(const SymbolTypes &types, const SymbolTable &symbols, std::string &out);
+
+// check one expression, appending "name :: TYPE" lines to out if it has no error
+bool processLine(const std::string &line, std::string &out, SymbolTable &symbols, Status &status);
+
+/*
+ * What checking took, phase by phase, summed over expressions. Only the overloads that take a Stats keep it: they run
+ * an instrumented copy of the checker (and an extra tokenizing pass, to time the lexer alone), so check() itself pays
+ * nothing for it.
+ */
+struct Stats {
+	long long expressions = 0;
+	long long bytes = 0;
+	long long tokens = 0;
+	long long nodes = 0;
+	long long constraints = 0; // joins and assigns
+	long long type_variables = 0;
+	long long find_steps = 0; // the parent links followed by find()
+	long long compress_writes = 0; // the parent links shortened by path halving
+	long long peak_bytes = 0; // the largest working memory of one check: parser stack, union-find and symbol tables
+	double tokenize_seconds = 0; // the extra tokenizing pass
+	double check_seconds = 0; // tokenizing, parsing and unifying, fused
+	double solve_seconds = 0; // numbering the classes
+	double format_seconds = 0; // the "name :: TYPE" lines
+
+	void add(const Stats &other);
+	// append one "stats: ..." line to out
+	void format(std::string &out) const;
+};
+
+SymbolTypes check(const char *source, std::size_t size, SymbolTable &symbols, Status &status, Stats &stats);
+bool processLine(const std::string &line, std::string &out, SymbolTable &symbols, Status &status, Stats &stats);
+
+// ============================================== incremental =========================================================
+
+/*
+ * Checks a sequence of expressions that are mostly edits of each other, such as the lines of a REPL session or the
+ * buffer of an editor, with the same results as check().
+ * After an edit that was costly to check, the subexpression around it (the region, of up to a few KiB) has its
+ * constraints unified after all the others, with an UndoUnionFind mark between them. A later well-typed edit inside the
+ * region that keeps the numbering of the symbols rolls back to the mark and unifies the constraints of the new region
+ * only, so it costs the region plus a comparison and copy of the two texts and a pass over the symbols.
+ * Any other edit resumes the fused check of a previous expression from the last checkpoint before the first
+ * difference (an UndoUnionFind mark and the length of the parser's trail), which costs the work after the edit.
+ */
+struct IncrementalChecker {
+	IncrementalChecker();
+	~IncrementalChecker();
+
+	SymbolTypes check(const std::string &source, Status &status);
+	// the symbols of the last expression checked
+	const SymbolTable &symbols() const;
+
+	long long reused = 0, rechecked = 0; // tokens whose check was reused or redone, over all calls
+
+	struct State;
+	std::unique_ptr<State> state;
+};
+
+// ================================================ session ===========================================================
+
+/*
+ * A sequence of lines that share one type environment, for building up a program line by line. A line is either an
+ * <expr> or a declaration
+ *   let <variable> = <expr>
+ * whose variable is in scope in every later line, until a later declaration of the same name hides it. Free
+ * variables, too, are the same from one line to the next, and what a line finds out about the type of a variable
+ * holds in the later ones. The symbols and the union-find are kept from line to line, so a line costs work in
+ * proportion to its own size.
+ */
+struct Session {
+	Session();
+	~Session();
+
+	// check one line, appending "name :: TYPE" lines for the variables that occur in it; on an error, the session is
+	// left as it was before the line
+	bool processLine(const char *line, std::size_t size, std::string &out, Status &status);
+	bool processLine(const std::string &line, std::string &out, Status &status);
+
+	long long lines = 0; // the lines checked successfully
+
+	struct State;
+	std::unique_ptr<State> state;
+};
+
+// ================================================= cache ============================================================
+
+/*
+ * An LRU cache of check() results, keyed by the token stream of the expression with every variable name replaced by
+ * its number in order of first appearance and every literal by its kind (the types do not depend on the values), so
+ * alpha-equivalent expressions have the same key. Along with the types, an entry keeps the name number of each symbol,
+ * from which a hit rebuilds the symbols of the expression (scopes included) as check() would have; a hit costs one
+ * tokenizing pass and no parsing or unification. Only successful checks are stored, because error messages and
+ * positions depend on the text. A capacity of 0 disables the cache.
+ */
+struct CheckCache {
+	explicit CheckCache(std::size_t capacity0 = 0) : capacity(capacity0) {}
+	// index points into entries, so a copy would point into the original
+	CheckCache(const CheckCache &) = delete;
+	CheckCache &operator=(const CheckCache &) = delete;
+	CheckCache(CheckCache &&) = default;
+	CheckCache &operator=(CheckCache &&) = default;
+
+	// check() through the cache
+	SymbolTypes check(const char *source, std::size_t size, SymbolTable &symbols, Status &status);
+
+	std::size_t capacity;
+	long long hits = 0, misses = 0;
+
+	struct Result {
+		SymbolTypes types;
+		std::vector<int> names; // by symbol: the number of its name
+	};
+	typedef std::list<std::pair<std::string, Result>> Entries;
+	Entries entries; // most recently used first
+	std::unordered_map<std::string, Entries::iterator> index;
+	std::string key; // scratch space for the key of the expression being checked
+	SymbolTable names; // scratch space for the names of the expression being checked, numbered for the key
+};
+
+// ================================================= batch ============================================================
+
+// the state of one batch thread, kept from one call of processLines() to the next
+struct BatchWorker {
+	explicit BatchWorker(std::size_t cache_capacity = 0) : cache(cache_capacity) {}
+
+	SymbolTable symbols;
+	Status status;
+	CheckCache cache;
+	bool measure = false; // check with stats (and without the cache)
+	Stats stats;
+};
+
+// check one expression with the worker and append its record to out, as processLines() does for each line
+void processRecord(const char *line, std::size_t size, std::string &out, BatchWorker &w);
+
+/*
+ * Check every line of text as an independent expression and append one record per line to out, in input order: the
+ * line's "name :: TYPE" lines or its error message, followed by an empty line. A last line without '\n' counts
+ * unless it is empty.
+ * The lines are split into chunks that one thread per worker (there must be at least one) takes from work-stealing
+ * queues; each thread uses only its own worker, and writes only the output of the chunks it took.
+ */
+void processLines(const char *text, std::size_t size, std::vector<BatchWorker> &workers, std::string &out);
+
+// The end of the expression at begin, which must not be whitespace: just after its matching ), or after its one
+// token if it does not start with ( (a ) on its own is a token, too). An unmatched ( runs to end.
+const char *expressionEnd(const char *begin, const char *end);
+
+// the end of the whitespace from p on, at most end
+const char *skipSpaces(const char *p, const char *end);
+
+/*
+ * processLines() for a text of expressions separated by whitespace, where an expression may span lines: each one
+ * found by expressionEnd() is a record. The text is only read in place, and error positions count from the start of
+ * the expression.
+ */
+void processExpressions(const char *text, std::size_t size, std::vector<BatchWorker> &workers, std::string &out);
+
+} // namespace typeinfer
+
+#endif